@@ -0,0 +1,1011 @@
+/** Замер времени выполнения каждой функции библиотеки.
+ *
+ * Вместо настоящего модуля используется его модель AlashUartMP3Sim, которая передаёт байты
+ * с той же задержкой, что и порт на 9600 бод, поэтому результаты не зависят от модуля и карты
+ * и их можно сравнивать между версиями библиотеки.
+ *
+ * Модель лежит в extras/sim: для платы скопируйте AlashUartMP3Sim.h и AlashUartMP3Sim.cpp в папку скетча,
+ * на компьютере пример собирается и запускается сборкой из extras/host (ctest).
+ *
+ * Результат выводится в Serial Monitor в формате CSV:
+ *
+ *     call,us,tx_bytes,rx_bytes,calls_per_sec
+ *
+ *   * us            - среднее время одного вызова, включая передачу всех байтов по линии, мкс
+ *   * tx_bytes      - байтов отправлено модулю за один вызов
+ *   * rx_bytes      - байтов получено от модуля за один вызов
+ *   * calls_per_sec - сколько таких вызовов можно сделать подряд за секунду
+ *
+ * Затем - подбор паузы между кадрами (setInterFrameGap()) для модуля, которому нужно
+ * GAP_REQUIRED мкс между командами:
+ *
+ *     gap_us,frames_sent,frames_lost,us_per_frame
+ *
+ * И наконец - сколько процессорного времени занимает сама отправка команды без данных (play())
+ * кадром, собранным во время выполнения, и готовым кадром из флеш-памяти (модель без задержек линии):
+ *
+ *     frame,us_per_1000_calls,flash_bytes
+ *
+ * И сколько процессорного времени занимает приём ответа через Stream (виртуальные вызовы на каждый байт)
+ * и через AlashUartMP3Serial<класс порта> (прямые вызовы в цикле приёма), порт мгновенно отвечает готовым кадром:
+ *
+ *     stream,us_per_1000_calls,rx_bytes,ns_per_byte
+ *
+ * И каталог файлов (AlashUartMP3Index): сколько длится сканирование носителя, сколько памяти
+ * занимает файл и сколько длится поиск номера по имени без обращения к модулю:
+ *
+ *     files,bytes_per_file,scan_ms,find_us
+ *
+ * И время запуска файла в папке на большой карте (LARGE_FILES файлов, модуль ищет путь перебором FAT):
+ * по пути (как без каталога папок) и по номеру FAT из каталога папок (AlashUartMP3FolderIndex):
+ *
+ *     folder_play,path_us,index_us,folders,scan_ms
+ *
+ * И тишина между треками списка воспроизведения (короткие треки по PLAYLIST_SECONDS секунд):
+ * следующий трек запускается по busy() в цикле и списком AlashUartMP3Playlist:
+ *
+ *     playlist,tracks,gaps,avg_gap_us,max_gap_us
+ *
+ * И случайный выбор трека для круга из всех файлов носителя: random() с проверкой текущего файла у модуля
+ * (как было в примере RandomPlay) и AlashUartMP3Shuffle - сколько стоит выбор и сколько файлов повторилось за круг:
+ *
+ *     shuffle,picks,us_per_pick,repeats
+ *
+ * И чтение ненадёжного статуса (модуль в STATUS_GLITCHES случаях из тысячи путает воспроизведение и паузу):
+ * одним запросом, старой проверкой "3 ответа подряд" (MP3_STATUS_CHECKS_IN_AGREEMENT 3) и setStatusChecks(3),
+ * которая переспрашивает только неожиданные ответы:
+ *
+ *     status,calls,queries,wrong,max_queries
+ *
+ * И полное состояние модуля (статус, номер, позиция, длина и имя текущего файла): пятью блокирующими
+ * вызовами подряд и одним snapshot(), который отправляет все запросы сразу и разбирает ответы по мере прихода;
+ * matches - совпали ли все поля снимка с результатами отдельных вызовов:
+ *
+ *     snapshot,fields,sequential_us,snapshot_us,matches
+ *
+ * И запуск модуля (модуль загружается BOOT_MS после включения питания): прежний reset(), reset() с ожиданием
+ * готовности и warmStart() - для модуля, который уже работает (играет или стоит) и который только что включили;
+ * frames_lost - сколько команд модуль не заметил, пока загружался, settings_ok - стоит ли модуль на первом файле
+ * с громкостью по умолчанию после вызова:
+ *
+ *     boot,call,ms,frames_sent,frames_lost,settings_ok
+ *
+ * И хранение настроек (setStore()): сколько раз записывается хранилище, пока громкость крутят регулятором
+ * (STORE_STEPS шагов) и меняют эквалайзер, при записи сразу и с задержкой MP3_STORE_DELAY:
+ *
+ *     store,changes,writes
+ *
+ * и восстановление после перезагрузки контроллера без хранилища и с ним - для только что включённого модуля
+ * и для оставшегося включённым; settings_ok - выставлены ли модулю сохранённые громкость и эквалайзер:
+ *
+ *     restore,ms,frames_sent,settings_ok
+ *
+ * И таймауты приёма: TIMEOUT_REQUESTS запросов статуса, модуль теряет TIMEOUT_DROPS байтов ответа из тысячи
+ * и отвечает со случайной добавкой к задержке до jitter_ms; постоянные таймауты (1000 и 150 мс) и подстраиваемые
+ * под измеренную задержку; failed - запросов без ответа, late - ответов, пришедших после таймаута (ложных отказов):
+ *
+ *     timeouts,jitter_ms,failed,late,total_ms,worst_ms
+ *
+ * И ожидание в блокирующих вызовах (setWaitStrategy()): WAIT_CALLS запросов статуса и номера файла
+ * непрерывным опросом порта, с yield() и сном до ожидаемого ответа; busy_percent - какую долю времени
+ * ожидания занят процессор (остальное отдано другим задачам; только при включённой статистике MP3_METRICS):
+ *
+ *     wait,calls,ms,busy_percent
+ *
+ * И общая пропускная способность нескольких модулей на разных портах: одна и та же работа
+ * (GROUP_ROUNDS раз громкость и запрос состояния каждому модулю) по очереди блокирующими вызовами
+ * и группой AlashUartMP3Group, которая ведёт обмен со всеми модулями одновременно:
+ *
+ *     modules,commands,sequential_ms,group_ms,commands_per_sec
+ *
+ * @author Alash Engineer, 2020, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <AlashUartMP3.h>
+#include "AlashUartMP3Sim.h" // extras/sim, на плате - скопировать AlashUartMP3Sim.h и .cpp в папку скетча
+#include <AlashUartMP3Index.h>
+#include <AlashUartMP3FolderIndex.h>
+#include <AlashUartMP3Playlist.h>
+#include <AlashUartMP3Shuffle.h>
+#include <AlashUartMP3Group.h>
+#include <AlashUartMP3Store.h>
+
+AlashUartMP3Sim module(9600); // Модель модуля вместо последовательного порта
+
+// Библиотека с доступом к обычной отправке команды - для сравнения с готовыми кадрами
+class BenchmarkMP3 : public AlashUartMP3
+{
+  public:
+    BenchmarkMP3(Stream &serial) : AlashUartMP3(serial) { }
+    void playRuntimeFrame() { sendCommand(MP3_CMD_PLAY); }
+
+    // reset() в том виде, в каком он был до waitReady(): настройки сразу, затем до 5 попыток
+    //  по 9 блокирующих запросов источников (каждый ждёт ответа до MP3_TIMEOUT_FIRST_BYTE)
+    void legacyReset()
+    {
+      uint8_t retry = 5;
+      do
+      {
+        beginBatch();
+        sendFixedCommand<MP3_CMD_STOP>();
+        sendFixedCommand<MP3_CMD_RESET>();
+        sentVolume = sentEq = sentLoop = MP3_STATE_UNKNOWN;
+        setVolume(67);
+        setEqualizer(0);
+        setLoopMode(2);
+        seekFileByIndexNumber(1);
+        sendFixedCommand<MP3_CMD_STOP>();
+        endBatch();
+
+        uint8_t timeout = 9;
+        while(timeout-- > 0)
+        {
+          if(getAvailableSources())
+          {
+            retry = 0;
+            break;
+          }
+          delay(1);
+        }
+      }
+      while(retry-- > 0);
+      refreshSource();
+    }
+
+    // Смена сцены (см. scene()) командами по одной, как до очереди команд: перед каждой до 10 мс ждём
+    //  и вычитываем мусор на линии, затем пишем кадр; громкость 80% - это 24 из 30
+    void legacyScene()
+    {
+      const uint8_t frames[4][6] = {
+        { MP3_CMD_BEGIN, MP3_CMD_VOL_SET,  1, 24 },
+        { MP3_CMD_BEGIN, MP3_CMD_EQ_SET,   1, MP3_EQ_POP },
+        { MP3_CMD_BEGIN, MP3_CMD_LOOP_SET, 1, MP3_LOOP_ALL },
+        { MP3_CMD_BEGIN, MP3_CMD_PLAY_IDX, 2, 0, 12 }
+      };
+      for(uint8_t x = 0; x < 4; x++)
+      {
+        uint8_t frame[6];
+        uint8_t length = frames[x][2] == 2 ? 6 : 5;
+        memcpy(frame, frames[x], sizeof(frame));
+        frame[length - 1] = 0;
+        for(uint8_t y = 0; y < length - 1; y++) frame[length - 1] += frame[y];
+
+        uint32_t quietSince = millis();
+        while(millis() - quietSince < 10)
+        {
+          if(_Serial->available())
+          {
+            _Serial->read();
+            quietSince = millis();
+          }
+          else
+          {
+            waitIdle((10 - (millis() - quietSince)) * 1000UL);
+          }
+        }
+        _Serial->write(frame, length);
+      }
+    }
+};
+
+BenchmarkMP3    mp3(module);
+
+// Порт, который на каждый кадр сразу отвечает кадром с тем же байтом команды и именем файла -
+//  без модели модуля, чтобы было видно стоимость самого приёма байта
+class ReplayStream : public Stream
+{
+  public:
+    virtual int    available() { return length - position; }
+    virtual int    read()      { return position < length ? response[position++] : -1; }
+    virtual int    peek()      { return position < length ? response[position] : -1; }
+    virtual size_t write(uint8_t b) { return this->write(&b, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+      const uint8_t name[] = "REPLAY  MP3";
+      uint8_t sum = 0;
+      length = 0;
+      response[length++] = 0xAA;
+      response[length++] = size > 1 ? buffer[1] : 0;
+      response[length++] = sizeof(name) - 1;
+      memcpy(response + length, name, sizeof(name) - 1);
+      length += sizeof(name) - 1;
+      for(uint8_t x = 0; x < length; x++) sum += response[x];
+      response[length++] = sum;
+      position = 0;
+      return size;
+    }
+    virtual void   flush() { }
+    using Print::write;
+
+  protected:
+    uint8_t response[16];
+    uint8_t length   = 0;
+    uint8_t position = 0;
+};
+
+// Хранилище настроек в ОЗУ, которое считает записи
+class CountingStore : public AlashUartMP3Store
+{
+  public:
+    virtual bool load(uint8_t *data, uint8_t length)
+    {
+      if(!writes) return false;
+      memcpy(data, record, length);
+      return true;
+    }
+    virtual bool save(const uint8_t *data, uint8_t length)
+    {
+      memcpy(record, data, length);
+      writes++;
+      return true;
+    }
+
+    uint32_t writes = 0;
+
+  protected:
+    uint8_t record[MP3_STORE_RECORD_SIZE];
+};
+
+CountingStore store;
+
+ReplayStream                     replay;
+AlashUartMP3                     replayStream(replay); // Через Stream
+AlashUartMP3Serial<ReplayStream> replayDirect(replay); // Через класс порта
+
+#if defined(__AVR__)
+AlashUartMP3StaticIndex<40>  files(mp3); // Каталог файлов, на AVR - только часть носителя
+#else
+AlashUartMP3StaticIndex<200> files(mp3);
+#endif
+AlashUartMP3StaticFolderIndex<50> folders(mp3); // Каталог папок
+AlashUartMP3Playlist playlist(mp3);
+AlashUartMP3Shuffle  shuffle(mp3);
+
+// Модули для замера группы, каждый на своём "порту"
+struct Speaker
+{
+  AlashUartMP3Sim module;
+  AlashUartMP3    mp3;
+  Speaker() : module(9600), mp3(module) { }
+};
+
+#if defined(__AVR__)
+const uint8_t GROUP_MODULES = 2;
+#else
+const uint8_t GROUP_MODULES = 8;
+#endif
+Speaker speakers[GROUP_MODULES];
+
+// Список: подряд идущие в FAT треки и переходы
+const uint16_t PROGRAMME[] PROGMEM = { 5, 6, 7, 40, 12, 13, 100, 3 };
+const uint8_t  PROGRAMME_LENGTH    = sizeof(PROGRAMME) / sizeof(PROGRAMME[0]);
+
+// Список для playSequenceByFileNumber_P()
+const uint8_t  SEQUENCE[] PROGMEM  = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+const uint8_t  REPEATS      = 5;    // Сколько раз повторить каждый вызов
+const uint16_t GAP_REQUIRED = 1000; // Пауза между кадрами, без которой модель пропускает команду, мкс
+const uint8_t  GAP_FRAMES   = 20;   // Сколько команд отправить одним пакетом при подборе паузы
+const uint16_t CPU_CALLS    = 1000; // Сколько команд отправить при замере процессорного времени
+const uint16_t LARGE_FILES  = 3000; // Файлов на "большой карте"
+const uint8_t  LARGE_FOLDERS = 30;  // Папок на ней
+const uint16_t FAT_LOOKUP_US = 50;  // Сколько модуль тратит на каждый файл при поиске пути, мкс
+const uint16_t PLAYLIST_SECONDS = 3; // Длина трека при замере тишины между треками
+const uint16_t SHUFFLE_FILES = 200;  // Файлов на носителе при замере случайного выбора
+const uint8_t  GROUP_ROUNDS  = 10;   // Сколько раз повторить работу каждого модуля при замере группы
+const uint16_t STATUS_CALLS  = 200;  // Сколько раз прочитать статус при замере проверки статуса
+const uint16_t STATUS_GLITCHES = 50; // Неверных ответов о статусе на тысячу
+const uint16_t BOOT_MS       = 500;  // Сколько модуль загружается после включения питания, мс
+const uint8_t  STORE_STEPS   = 20;   // Шагов регулятора громкости при замере записи настроек
+const uint16_t TIMEOUT_REQUESTS = 200; // Запросов статуса при замере таймаутов
+const uint16_t TIMEOUT_DROPS = 20;   // Потерянных байтов ответа на тысячу при замере таймаутов
+const uint16_t WAIT_CALLS    = 100;  // Запросов при замере способов ожидания
+
+// Выполняет вызов REPEATS раз и выводит строку результата
+void measure(const char *name, void (*call)())
+{
+  module.settle();
+  module.resetCounters();
+
+  uint32_t start = micros();
+  for(uint8_t x = 0; x < REPEATS; x++)
+  {
+    call();
+  }
+  mp3.flush();
+  module.settle();
+  uint32_t us = (micros() - start) / REPEATS;
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(us);
+  Serial.print(',');
+  Serial.print(module.bytesReceived / REPEATS);
+  Serial.print(',');
+  Serial.print(module.bytesSent / REPEATS);
+  Serial.print(',');
+  Serial.println(us ? 1000000UL / us : 0);
+}
+
+// Смена "сцены" - несколько настроек и запуск трека
+void scene()
+{
+  mp3.setVolume(80);
+  mp3.setEqualizer(MP3_EQ_POP);
+  mp3.setLoopMode(MP3_LOOP_ALL);
+  mp3.playFileByIndexNumber(12);
+}
+
+// Отправляет GAP_FRAMES команд одним пакетом с заданной паузой и выводит, сколько из них модуль пропустил
+void measureGap(uint16_t gap)
+{
+  mp3.setInterFrameGap(gap);
+  module.settle();
+  module.resetCounters();
+
+  uint32_t start = micros();
+  mp3.beginBatch();
+  for(uint8_t x = 0; x < GAP_FRAMES; x++)
+  {
+    mp3.setVolume(x % 2 ? 60 : 70);
+  }
+  mp3.endBatch();
+  module.settle();
+  uint32_t us = micros() - start;
+
+  Serial.print(gap);
+  Serial.print(',');
+  Serial.print(GAP_FRAMES);
+  Serial.print(',');
+  Serial.print(module.framesIgnored);
+  Serial.print(',');
+  Serial.println(us / GAP_FRAMES);
+}
+
+// Отправляет CPU_CALLS команд play() без задержек линии и выводит время на 1000 вызовов
+void measureCpu(const char *name, void (*call)(), uint8_t flashBytes)
+{
+  module.settle();
+  uint32_t start = micros();
+  for(uint16_t x = 0; x < CPU_CALLS; x++)
+  {
+    call();
+  }
+  uint32_t us = micros() - start;
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(us * 1000UL / CPU_CALLS);
+  Serial.print(',');
+  Serial.println(flashBytes);
+}
+
+// Запрашивает CPU_CALLS раз имя файла через порт, отвечающий мгновенно, и выводит время на 1000 вызовов и на байт ответа
+void measureStream(const char *name, AlashUartMP3 &driver)
+{
+  char     buffer[12];
+  uint32_t start = micros();
+  for(uint16_t x = 0; x < CPU_CALLS; x++)
+  {
+    driver.currentFileName(buffer, sizeof(buffer));
+  }
+  uint32_t us = micros() - start;
+  const uint8_t rxBytes = 15;
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(us * 1000UL / CPU_CALLS);
+  Serial.print(',');
+  Serial.print(rxBytes);
+  Serial.print(',');
+  Serial.println(us * 1000UL / CPU_CALLS / rxBytes);
+}
+
+// Время от команды запуска файла в папке до начала воспроизведения (модуль не отвечает, пока ищет файл)
+uint32_t measureFolderPlay(uint8_t folder, uint16_t file)
+{
+  mp3.stop();
+  module.settle();
+  uint32_t start = micros();
+  mp3.playFileNumberInFolderNumber(folder, file);
+  while(mp3.getStatus() != MP3_STATUS_PLAYING);
+  return micros() - start;
+}
+
+// Выбирает SHUFFLE_FILES треков функцией pick() и выводит время выбора и количество повторов за круг
+void measureShuffle(const char *name, uint16_t (*pick)())
+{
+  static uint8_t seen[(SHUFFLE_FILES + 7) / 8];
+  memset(seen, 0, sizeof(seen));
+
+  module.settle();
+  uint16_t repeats = 0;
+  uint32_t start   = micros();
+  for(uint16_t x = 0; x < SHUFFLE_FILES; x++)
+  {
+    uint16_t file = pick() - 1;
+    if(seen[file / 8] & (1 << (file % 8))) repeats++;
+    seen[file / 8] |= 1 << (file % 8);
+  }
+  uint32_t us = micros() - start;
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(SHUFFLE_FILES);
+  Serial.print(',');
+  Serial.print(us / SHUFFLE_FILES);
+  Serial.print(',');
+  Serial.println(repeats);
+}
+
+// Работа для modules модулей по очереди, блокирующими вызовами; возвращает время, мкс
+uint32_t measureSequential(uint8_t modules)
+{
+  uint32_t start = micros();
+  for(uint8_t r = 0; r < GROUP_ROUNDS; r++)
+  {
+    for(uint8_t m = 0; m < modules; m++)
+    {
+      speakers[m].mp3.setVolume(r % 2 ? 60 : 70);
+      speakers[m].mp3.getStatus();
+    }
+  }
+  return micros() - start;
+}
+
+// Та же работа группой: команды и запросы всем модулям ставятся в очереди, ответы ждутся одновременно
+uint32_t measureGroup(uint8_t modules)
+{
+  AlashUartMP3StaticGroup<GROUP_MODULES> group;
+  AlashUartMP3Request status[GROUP_MODULES];
+  for(uint8_t m = 0; m < modules; m++)
+  {
+    group.add(speakers[m].mp3);
+  }
+  group.setAsync(true);
+
+  uint32_t start = micros();
+  for(uint8_t r = 0; r < GROUP_ROUNDS; r++)
+  {
+    for(uint8_t m = 0; m < modules; m++)
+    {
+      speakers[m].mp3.setVolume(r % 2 ? 60 : 70);
+      speakers[m].mp3.requestStatus(status[m]);
+    }
+    group.flush();
+  }
+  uint32_t us = micros() - start;
+
+  group.setAsync(false);
+  for(uint8_t m = 0; m < modules; m++)
+  {
+    speakers[m].mp3.setGroup(NULL);
+  }
+  return us;
+}
+
+// Статус, как его читала проверка MP3_STATUS_CHECKS_IN_AGREEMENT 3: пока три ответа подряд не совпадут
+uint8_t agreementStatus()
+{
+  uint8_t statTotal;
+  do
+  {
+    statTotal = 0;
+    for(uint8_t x = 0; x < 3; x++)
+    {
+      uint8_t stat = mp3.getStatus();
+      if(stat == 0) return 0;
+      statTotal += stat;
+    }
+  } while(statTotal != 1 * 3 && statTotal != 2 * 3);
+  return statTotal / 3;
+}
+
+// Читает статус STATUS_CALLS раз, время от времени ставя на паузу и снимая с неё, и выводит,
+//  сколько запросов понадобилось и сколько раз прочитанный статус был неверным
+void measureStatus(const char *name, uint8_t (*read)())
+{
+  uint16_t wrong      = 0;
+  uint8_t  maxQueries = 0;
+  uint32_t queries    = 0;
+  for(uint16_t x = 0; x < STATUS_CALLS; x++)
+  {
+    if(x % 20 == 10) mp3.pause();
+    if(x % 20 == 0)  mp3.play();
+
+    module.resetCounters();
+    uint8_t stat = read();
+    uint8_t sent = module.framesReceived;
+
+    if(stat != module.status()) wrong++;
+    if(sent > maxQueries) maxQueries = sent;
+    queries += sent;
+  }
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(STATUS_CALLS);
+  Serial.print(',');
+  Serial.print(queries);
+  Serial.print(',');
+  Serial.print(wrong);
+  Serial.print(',');
+  Serial.println(maxQueries);
+}
+
+// Пять отдельных запросов состояния и один снимок, строка результата
+void measureSnapshot()
+{
+  AlashUartMP3Snapshot expected;
+  uint32_t start = micros();
+  expected.status   = mp3.getStatus();
+  expected.index    = mp3.currentFileIndexNumber();
+  expected.position = mp3.currentFilePositionInSeconds();
+  expected.length   = mp3.currentFileLengthInSeconds();
+  mp3.currentFileName(expected.name, sizeof(expected.name));
+  uint32_t sequentialUs = micros() - start;
+
+  AlashUartMP3Snapshot snap;
+  mp3.snapshot(snap);
+
+  bool matches = snap.valid == MP3_SNAPSHOT_ALL
+              && snap.status == expected.status
+              && snap.index == expected.index
+              && snap.position >= expected.position && snap.position <= expected.position + 1
+              && snap.length == expected.length
+              && !strcmp(snap.name, expected.name);
+
+  Serial.print(snap.valid, HEX);
+  Serial.print(',');
+  Serial.print(sequentialUs);
+  Serial.print(',');
+  Serial.print(snap.micros);
+  Serial.print(',');
+  Serial.println(matches ? F("yes") : F("no"));
+}
+
+// Приводит модель в состояние scenario, выполняет запуск модуля и выводит строку результата
+void measureBoot(const char *scenario, const char *name, void (*call)())
+{
+  module.setBootTime(BOOT_MS * 1000UL);
+  module.powerOn();
+  if(strcmp(scenario, "cold"))
+  {
+    // Модуль включён давно, контроллер перезагрузился
+    delay(BOOT_MS + 10);
+    mp3.setVolume(100);
+    mp3.playFileByIndexNumber(5);
+    if(!strcmp(scenario, "stopped")) mp3.stop();
+    mp3.setVolume(67);
+    module.settle();
+  }
+
+  module.resetCounters();
+  uint32_t start = millis();
+  call();
+  module.settle();
+  uint32_t ms = millis() - start;
+
+  bool ok = module.volume() == 20 && module.currentIndex() <= 5 && module.status() == MP3_STATUS_STOPPED;
+
+  Serial.print(scenario);
+  Serial.print(',');
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(ms);
+  Serial.print(',');
+  Serial.print(module.framesReceived + module.framesIgnored);
+  Serial.print(',');
+  Serial.print(module.framesIgnored);
+  Serial.print(',');
+  Serial.println(ok ? F("yes") : F("no"));
+}
+
+// Крутит громкость и меняет эквалайзер, вызывая poll(), и выводит, сколько было записей в хранилище
+void measureStore(const char *name, uint16_t delayMs)
+{
+  // Шаг регулятора - шаг модуля из 30: с нуля STORE_STEPS шагов не упираются в максимум
+  mp3.setVolume(0);
+  store.writes = 0;
+  mp3.setStore(&store, delayMs);
+  for(uint8_t x = 0; x < STORE_STEPS; x++)
+  {
+    mp3.volumeUp();
+    uint32_t start = millis();
+    while(millis() - start < 50) mp3.poll();
+  }
+  mp3.setEqualizer(MP3_EQ_ROCK);
+  uint32_t start = millis();
+  while(millis() - start < MP3_STORE_DELAY + 100) mp3.poll();
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(STORE_STEPS + 1);
+  Serial.print(',');
+  Serial.println(store.writes);
+}
+
+// Перезагрузка контроллера: новый объект библиотеки, модуль только что включён (cold) или остался включённым
+void measureRestore(const char *name, bool cold, bool useStore)
+{
+  module.setBootTime(BOOT_MS * 1000UL);
+  module.powerOn();
+  if(!cold)
+  {
+    delay(BOOT_MS + 10);
+    module.settle();
+  }
+
+  AlashUartMP3 fresh(module);
+  module.resetCounters();
+  uint32_t start = millis();
+  if(useStore) fresh.setStore(&store);
+  if(cold) fresh.reset(); else fresh.warmStart();
+  module.settle();
+  uint32_t ms = millis() - start;
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(ms);
+  Serial.print(',');
+  Serial.print(module.framesReceived + module.framesIgnored);
+  Serial.print(',');
+  Serial.println(module.volume() == (mp3.getVolume() * 30) / 100 && module.equalizer() == MP3_EQ_ROCK ? F("yes") : F("no"));
+}
+
+// Запросы статуса к модулю, который теряет байты ответа
+uint16_t lateFrames;
+
+void measureTimeouts(const char *name, uint16_t jitterMs)
+{
+  module.setResponseJitter(jitterMs * 1000UL);
+  module.setFaults(TIMEOUT_DROPS, 0);
+  mp3.onUnsolicitedFrame([](uint8_t, const uint8_t *, uint8_t, void *) { lateFrames++; });
+  randomSeed(1);
+  lateFrames = 0;
+
+  uint16_t failed = 0;
+  uint32_t worst  = 0;
+  uint32_t start  = millis();
+  for(uint16_t x = 0; x < TIMEOUT_REQUESTS; x++)
+  {
+    uint32_t requestStart = millis();
+    AlashUartMP3Request request;
+    mp3.requestStatus(request);
+    while(request.pending()) mp3.poll();
+    if(request.result != MP3_RESULT_OK) failed++;
+    if(millis() - requestStart > worst) worst = millis() - requestStart;
+  }
+  uint32_t totalMs = millis() - start;
+
+  // Опоздавшие ответы
+  module.setFaults(0, 0);
+  start = millis();
+  while(millis() - start < 200) mp3.poll();
+  mp3.onUnsolicitedFrame(NULL);
+  module.setResponseJitter(0);
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(jitterMs);
+  Serial.print(',');
+  Serial.print(failed);
+  Serial.print(',');
+  Serial.print(lateFrames);
+  Serial.print(',');
+  Serial.print(totalMs);
+  Serial.print(',');
+  Serial.println(worst);
+}
+
+#if MP3_METRICS
+// Блокирующие запросы при одном способе ожидания
+void measureWait(const char *name, uint8_t strategy)
+{
+  mp3.setWaitStrategy(strategy);
+  uint32_t waited = mp3.getMetrics().waitMicros;
+  uint32_t start  = micros();
+  for(uint16_t x = 0; x < WAIT_CALLS; x++)
+  {
+    mp3.getStatus();
+    mp3.currentFileIndexNumber();
+  }
+  uint32_t total = micros() - start;
+  waited = mp3.getMetrics().waitMicros - waited;
+  mp3.setWaitStrategy(MP3_WAIT_SPIN);
+
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(WAIT_CALLS * 2);
+  Serial.print(',');
+  Serial.print(total / 1000);
+  Serial.print(',');
+  Serial.println(total >= 100 ? 100 - waited / (total / 100) : 0);
+}
+#endif
+
+// Выводит строку результата замера тишины между треками
+void printGaps(const char *name)
+{
+  Serial.print(name);
+  Serial.print(',');
+  Serial.print(module.tracksFinished);
+  Serial.print(',');
+  Serial.print(module.trackGaps);
+  Serial.print(',');
+  Serial.print(module.trackGaps ? module.trackGapTotal / module.trackGaps : 0);
+  Serial.print(',');
+  Serial.println(module.trackGapMax);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  module.setMedia(200, 180, 10); // 200 файлов по 3 минуты в 10 папках
+  mp3.reset();
+  mp3.playFileByIndexNumber(1);
+
+  Serial.println(F("call,us,tx_bytes,rx_bytes,calls_per_sec"));
+
+  measure("play",                         []() { mp3.play(); });
+  measure("pause",                        []() { mp3.pause(); });
+  measure("restart",                      []() { mp3.restart(); });
+  measure("next",                         []() { mp3.next(); });
+  measure("prev",                         []() { mp3.prev(); });
+  measure("nextFolder",                   []() { mp3.nextFolder(); });
+  measure("prevFolder",                   []() { mp3.prevFolder(); });
+  measure("fastForward",                  []() { mp3.fastForward(); });
+  measure("rewind",                       []() { mp3.rewind(); });
+  measure("playFileByIndexNumber",        []() { mp3.playFileByIndexNumber(42); });
+  measure("interjectFileByIndexNumber",   []() { mp3.interjectFileByIndexNumber(7); });
+  measure("playFileNumberInFolderNumber", []() { mp3.playFileNumberInFolderNumber(3, 6); });
+  measure("playInFolderNumber",           []() { mp3.playInFolderNumber(4); });
+  measure("seekFileByIndexNumber",        []() { mp3.seekFileByIndexNumber(10); });
+  measure("abLoopPlay",                   []() { mp3.abLoopPlay(25, 50); });
+  measure("abLoopClear",                  []() { mp3.abLoopClear(); });
+  measure("volumeUp",                     []() { mp3.volumeUp(); });
+  measure("volumeDn",                     []() { mp3.volumeDn(); });
+  measure("setVolume",                    []() { mp3.setVolume(50); });
+  measure("setEqualizer",                 []() { mp3.setEqualizer(MP3_EQ_ROCK); });
+  measure("setLoopMode",                  []() { mp3.setLoopMode(MP3_LOOP_ALL); });
+  measure("setSource",                    []() { mp3.setSource(MP3_SRC_SDCARD); });
+  measure("getSource",                    []() { mp3.getSource(); });
+  measure("sourceAvailable",              []() { mp3.sourceAvailable(MP3_SRC_SDCARD); });
+  measure("getStatus",                    []() { mp3.getStatus(); });
+  measure("busy",                         []() { mp3.busy(); });
+  measure("countFiles",                   []() { mp3.countFiles(); });
+  measure("currentFileIndexNumber",       []() { mp3.currentFileIndexNumber(); });
+  measure("currentFilePositionInSeconds", []() { mp3.currentFilePositionInSeconds(); });
+  measure("currentFileLengthInSeconds",   []() { mp3.currentFileLengthInSeconds(); });
+  measure("currentFileName",              []() { char buf[12]; mp3.currentFileName(buf, sizeof(buf)); });
+  measure("playSequenceByFileNumber",     []() { uint8_t list[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }; mp3.playSequenceByFileNumber(list, sizeof(list)); });
+  measure("playSequenceByFileName",       []() { const char *list[] = { "01", "02", "03" }; mp3.playSequenceByFileName(list, 3); });
+  measure("playSequenceByFileNumber_P",   []() { mp3.playSequenceByFileNumber_P(SEQUENCE, sizeof(SEQUENCE)); });
+  measure("playSequence",                 []() { mp3.playSequence([](uint8_t position, void *) -> uint8_t { return position + 1; }, 10); });
+  measure("stop",                         []() { mp3.stop(); });
+  measure("sleep",                        []() { mp3.sleep(); });
+  measure("reset",                        []() { mp3.reset(); });
+  measure("sceneOneByOne",                []() { mp3.legacyScene(); });
+  measure("sceneSequential",              []() { scene(); });
+  measure("sceneBatch",                   []() { mp3.beginBatch(); scene(); mp3.endBatch(); });
+  measure("volumeKnob",                   []() { for(uint8_t x = 0; x < 20; x++) mp3.volumeUp(); for(uint8_t x = 0; x < 20; x++) mp3.volumeDn(); });
+  mp3.setCoalescing(true);
+  measure("volumeKnobCoalesced",          []() { for(uint8_t x = 0; x < 20; x++) mp3.volumeUp(); for(uint8_t x = 0; x < 20; x++) mp3.volumeDn(); mp3.flush(); });
+  measure("setEqualizerRepeated",         []() { mp3.setEqualizer(MP3_EQ_ROCK); });
+  mp3.setCoalescing(false);
+  measure("sceneBatchAsync",              []() { mp3.setAsync(true); mp3.beginBatch(); scene(); mp3.endBatch(); mp3.flush(); mp3.setAsync(false); });
+
+  // Подбор паузы между кадрами
+  module.setMinFrameGap(GAP_REQUIRED);
+  Serial.println(F("gap_us,frames_sent,frames_lost,us_per_frame"));
+  for(uint16_t gap = 0; gap <= 2000; gap += 250)
+  {
+    measureGap(gap);
+  }
+  module.setMinFrameGap(0);
+
+  // Процессорное время отправки: линия и пауза между кадрами не в счёт
+  module.setBaudRate(0);
+  mp3.setInterFrameGap(0);
+  Serial.println(F("frame,us_per_1000_calls,flash_bytes"));
+  measureCpu("runtime",  []() { mp3.playRuntimeFrame(); }, 0);
+  measureCpu("prebaked", []() { mp3.play(); }, sizeof(AlashUartMP3FixedFrame<0>::bytes));
+
+  Serial.println(F("stream,us_per_1000_calls,rx_bytes,ns_per_byte"));
+  replayStream.setInterFrameGap(0);
+  replayDirect.setInterFrameGap(0);
+  measureStream("virtual",  replayStream);
+  measureStream("template", replayDirect);
+  module.setBaudRate(9600);
+  mp3.setInterFrameGap(MP3_FRAME_GAP);
+
+  // Каталог файлов: одно сканирование, дальше поиск номера по имени без обмена с модулем
+  Serial.println(F("files,bytes_per_file,scan_ms,find_us"));
+  files.scan();
+  uint32_t start = micros();
+  uint16_t found = 0;
+  for(uint16_t x = 0; x < CPU_CALLS; x++)
+  {
+    found += files.find("007.MP3") ? 1 : 0;
+  }
+  Serial.print(files.count());
+  Serial.print(',');
+  Serial.print(AlashUartMP3Index::bytesPerEntry());
+  Serial.print(',');
+  Serial.print(files.scanMillis());
+  Serial.print(',');
+  Serial.println((micros() - start) / CPU_CALLS);
+
+  // Запуск файла в папке на большой карте: по пути и по каталогу папок
+  Serial.println(F("folder_play,path_us,index_us,folders,scan_ms"));
+  module.setMedia(LARGE_FILES, 180, LARGE_FOLDERS);
+  module.setPathLookupLatency(FAT_LOOKUP_US);
+  folders.scan();
+  const uint8_t plays[][2] = { { 1, 1 }, { LARGE_FOLDERS / 2, 50 }, { LARGE_FOLDERS, 100 } };
+  for(uint8_t x = 0; x < sizeof(plays) / sizeof(plays[0]); x++)
+  {
+    mp3.setFolderIndex(NULL);
+    uint32_t pathUs = measureFolderPlay(plays[x][0], plays[x][1]);
+    mp3.setFolderIndex(&folders);
+    measureFolderPlay(plays[x][0], plays[x][1]); // Первый запуск из папки идёт по пути и сверяет её с каталогом
+    uint32_t indexUs = measureFolderPlay(plays[x][0], plays[x][1]);
+
+    Serial.print(plays[x][0]);
+    Serial.print('/');
+    Serial.print(plays[x][1]);
+    Serial.print(',');
+    Serial.print(pathUs);
+    Serial.print(',');
+    Serial.print(indexUs);
+    Serial.print(',');
+    Serial.print(folders.folderCount());
+    Serial.print(',');
+    Serial.println(folders.scanMillis());
+  }
+  mp3.setFolderIndex(NULL);
+  module.setPathLookupLatency(0);
+  module.setMedia(200, 180, 10);
+
+  // Тишина между треками: по busy() в цикле и списком воспроизведения
+  Serial.println(F("playlist,tracks,gaps,avg_gap_us,max_gap_us"));
+  module.setMedia(200, PLAYLIST_SECONDS, 10);
+  mp3.setLoopMode(MP3_LOOP_NONE);
+  module.settle();
+  module.resetCounters();
+  for(uint8_t x = 0; x < PROGRAMME_LENGTH; x++)
+  {
+    mp3.playFileByIndexNumber(pgm_read_word(&PROGRAMME[x]));
+    delay(100);
+    while(mp3.busy());
+  }
+  printGaps("busy");
+
+  mp3.stop();
+  module.settle();
+  module.resetCounters();
+  playlist.setTracks_P(PROGRAMME, PROGRAMME_LENGTH);
+  playlist.start();
+  while(playlist.playing())
+  {
+    playlist.update();
+  }
+  printGaps("playlist");
+  module.setMedia(200, 180, 10);
+
+  // Случайный выбор трека: с проверкой у модуля и перестановкой без обмена с модулем
+  Serial.println(F("shuffle,picks,us_per_pick,repeats"));
+  mp3.stop();
+  measureShuffle("random",  []() -> uint16_t { uint16_t pick; do { pick = random(1, SHUFFLE_FILES + 1); } while(pick == mp3.currentFileIndexNumber()); return pick; });
+  shuffle.setCount(SHUFFLE_FILES);
+  measureShuffle("shuffle", []() -> uint16_t { return shuffle.next(); });
+
+  // Ненадёжный статус: один запрос, три согласованных подряд и адаптивная проверка
+  Serial.println(F("status,calls,queries,wrong,max_queries"));
+  module.setStatusGlitches(STATUS_GLITCHES);
+  randomSeed(1);
+  mp3.playFileByIndexNumber(1);
+  measureStatus("single",    []() -> uint8_t { return mp3.getStatus(); });
+  randomSeed(1);
+  measureStatus("agreement", agreementStatus);
+  randomSeed(1);
+  mp3.setStatusChecks(3);
+  measureStatus("adaptive",  []() -> uint8_t { return mp3.getStatus(); });
+  mp3.setStatusChecks(MP3_STATUS_CHECKS_IN_AGREEMENT);
+  module.setStatusGlitches(0);
+  mp3.stop();
+
+  // Состояние модуля: пять вызовов и один снимок
+  Serial.println(F("snapshot,fields,sequential_us,snapshot_us,matches"));
+  mp3.playFileByIndexNumber(42);
+  delay(1500);
+  Serial.print(F("playing,"));
+  measureSnapshot();
+  mp3.subscribePosition();
+  delay(1500);
+  Serial.print(F("subscribed,"));
+  measureSnapshot();
+  mp3.unsubscribePosition();
+  mp3.stop();
+
+  // Запуск модуля: прежний reset(), reset() с ожиданием готовности, тёплый старт
+  Serial.println(F("boot,call,ms,frames_sent,frames_lost,settings_ok"));
+  const char *scenarios[] = { "playing", "stopped", "cold" };
+  for(uint8_t x = 0; x < 3; x++)
+  {
+    measureBoot(scenarios[x], "legacy",    []() { mp3.legacyReset(); });
+    measureBoot(scenarios[x], "reset",     []() { mp3.reset(); });
+    measureBoot(scenarios[x], "warmStart", []() { mp3.warmStart(); });
+  }
+  module.setBootTime(0);
+  module.powerOn();
+  mp3.reset();
+
+  // Хранение настроек: запись сразу и с задержкой, восстановление после перезагрузки контроллера
+  Serial.println(F("store,changes,writes"));
+  measureStore("immediate", 0);
+  mp3.setVolume(67);
+  mp3.setEqualizer(MP3_EQ_NORMAL);
+  measureStore("delayed",   MP3_STORE_DELAY);
+  mp3.saveState();
+  Serial.println(F("restore,ms,frames_sent,settings_ok"));
+  measureRestore("cold_reset",          true,  false);
+  measureRestore("cold_reset_store",    true,  true);
+  measureRestore("warm_start",          false, false);
+  measureRestore("warm_start_store",    false, true);
+  mp3.setStore(NULL);
+  module.setBootTime(0);
+  module.powerOn();
+  mp3.reset();
+
+  // Таймауты: постоянные и подстраиваемые
+  Serial.println(F("timeouts,jitter_ms,failed,late,total_ms,worst_ms"));
+  const uint8_t jitters[] = { 0, 40 };
+  for(uint8_t x = 0; x < sizeof(jitters); x++)
+  {
+    mp3.setTimeoutLimits(MP3_TIMEOUT_FIRST_BYTE, MP3_TIMEOUT_FIRST_BYTE, MP3_TIMEOUT_INTERBYTE, MP3_TIMEOUT_INTERBYTE);
+    measureTimeouts("fixed",    jitters[x]);
+    mp3.setTimeoutLimits(MP3_TIMEOUT_FIRST_BYTE_MIN, MP3_TIMEOUT_FIRST_BYTE);
+    measureTimeouts("adaptive", jitters[x]);
+  }
+
+#if MP3_METRICS
+  // Способы ожидания в блокирующих вызовах
+  Serial.println(F("wait,calls,ms,busy_percent"));
+  measureWait("spin",  MP3_WAIT_SPIN);
+  measureWait("yield", MP3_WAIT_YIELD);
+  measureWait("sleep", MP3_WAIT_SLEEP);
+#endif
+
+  // Несколько модулей: по очереди и группой
+  Serial.println(F("modules,commands,sequential_ms,group_ms,commands_per_sec"));
+  for(uint8_t modules = 1; modules <= GROUP_MODULES; modules *= 2)
+  {
+    uint32_t sequentialUs = measureSequential(modules);
+    uint32_t groupUs      = measureGroup(modules);
+    uint16_t commands     = modules * GROUP_ROUNDS * 2;
+
+    Serial.print(modules);
+    Serial.print(',');
+    Serial.print(commands);
+    Serial.print(',');
+    Serial.print(sequentialUs / 1000);
+    Serial.print(',');
+    Serial.print(groupUs / 1000);
+    Serial.print(',');
+    Serial.println(groupUs ? commands * 1000000UL / groupUs : 0);
+  }
+
+#if MP3_METRICS
+  // Статистика обмена за весь прогон
+  mp3.dumpMetrics(Serial);
+#endif
+
+  Serial.println(F("# done"));
+}
+
+void loop()
+{
+}
@@ -1,4 +1,6 @@
 /** Пример, который воспроизводит файлы на носителе в случайном порядке.
+ *
+ * Каждый файл звучит ровно один раз за круг, после чего порядок перемешивается заново (AlashUartMP3Shuffle).
  *
  * @author Alash Engineer, 2020, alash.electronics@gmail.com
  * @license MIT License
@@ -12,8 +14,12 @@ SoftwareSerial mySoftwareSerial(8,9);
 // Создаём объект mp3, передавая ему последовательный порт
 // Например, можно использовать mp3(Serial2) вместо SoftwareSerial
 #include <AlashUartMP3.h>
+#include <AlashUartMP3Shuffle.h>
 AlashUartMP3 mp3(mySoftwareSerial);
 
+// Случайный порядок без повторов: хранит не список файлов, а только ключ перестановки
+AlashUartMP3Shuffle shuffle(mp3);
+
 unsigned int numFiles; // Общее количество файлов на носителе (определяется в setup())
 
 void setup() {
@@ -48,27 +54,25 @@ void setup() {
       delay(3000);
     }
   }
+
+  // Зерно для random() - шум неподключённого аналогового входа, иначе порядок будет одинаковым при каждом включении
+  randomSeed(analogRead(A0));
+  shuffle.setCount(numFiles);
 }
 
 void loop() 
 {
   if(!mp3.busy()) 
   {
-    // Выбираем случайный файл с номером от 1 до numFiles (random() возвращает до, но не включая верхнюю границу)
-    // Если выбран тот же файл, что только что играл — выбираем другой
-    unsigned int pick;
-    do
-    { 
-      pick = random(1,numFiles+1);
-    } while(pick == mp3.currentFileIndexNumber());
+    // Следующий файл круга: вычисляется без обмена с модулем и не повторяется, пока не прозвучат все файлы
+    unsigned int pick = shuffle.playNext();
     
     Serial.print("Случайно выбран файл №");
     Serial.print(pick);
     Serial.print(" из ");
-    Serial.println(numFiles);
-
-    // Воспроизводим выбранный файл
-    mp3.playFileByIndexNumber(pick);
+    Serial.print(numFiles);
+    Serial.print(", круг ");
+    Serial.println(shuffle.cycles() + 1);
    
     char buffer[20];
     mp3.currentFileName(buffer, sizeof(buffer));
@@ -0,0 +1,64 @@
+/**
+ * Время, случайные числа и Serial для сборки на компьютере, см. Arduino.h.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include "Arduino.h"
+#include <random>
+
+#if MP3_HOST_REALTIME
+  #include <chrono>
+  #include <thread>
+#endif
+
+HostSerial Serial;
+
+#if MP3_HOST_REALTIME
+
+static const std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+
+static unsigned long long elapsedMicros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startedAt).count();
+}
+
+unsigned long millis()                 { return elapsedMicros() / 1000; }
+unsigned long micros()                 { return elapsedMicros(); }
+void          delay(unsigned long ms)  { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+void          yield()                  { std::this_thread::yield(); }
+
+void delayMicroseconds(unsigned int us)
+{
+  // Как на плате - без отдачи процессора
+  unsigned long long until = elapsedMicros() + us;
+  while(elapsedMicros() < until) { }
+}
+
+#else
+
+// Виртуальное время, мкс: каждое обращение к часам "стоит" микросекунду, иначе цикл ожидания
+//  по micros() никогда бы не закончился
+static unsigned long long now = 0;
+
+unsigned long millis()                  { now += 1; return now / 1000; }
+unsigned long micros()                  { now += 1; return (unsigned long)now; }
+void          delay(unsigned long ms)   { now += ms * 1000ULL; }
+void          delayMicroseconds(unsigned int us) { now += us; }
+void          yield()                   { now += 1; }
+
+#endif
+
+static std::mt19937 generator(1);
+
+long random(long howbig)                { return howbig > 0 ? (long)(generator() % (unsigned long)howbig) : 0; }
+long random(long howsmall, long howbig) { return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall; }
+void randomSeed(unsigned long seed)     { generator.seed(seed); }
@@ -0,0 +1,127 @@
+/**
+ * Минимальная замена Arduino.h для сборки библиотеки AlashUartMP3 и модели модуля на компьютере.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+// Время (см. Arduino.cpp): по умолчанию виртуальное - каждый вызов millis()/micros() продвигает его
+//  на микросекунду, delay() - на заданное время, так что прогон не зависит от загрузки компьютера и идёт
+//  быстрее настоящего; при MP3_HOST_REALTIME 1 - настоящее время, delay() усыпляет поток.
+#ifndef MP3_HOST_REALTIME
+  #define MP3_HOST_REALTIME 0
+#endif
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define F(x) x
+#define HEX 16
+#define DEC 10
+
+inline void *memcpy_P(void *d, const void *s, size_t n) { return memcpy(d, s, n); }
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+inline char *itoa(int value, char *s, int radix)
+{
+  sprintf(s, radix == HEX ? "%x" : "%d", value);
+  return s;
+}
+
+class Print
+{
+  public:
+    virtual size_t write(uint8_t b) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+      size_t n = 0;
+      while(size--) n += this->write(*buffer++);
+      return n;
+    }
+
+    virtual void flush() { }
+    virtual ~Print() { }
+
+    size_t print(const char *s)                       { return this->write((const uint8_t *)s, strlen(s)); }
+    size_t print(char c)                              { return this->write((uint8_t)c); }
+    size_t print(unsigned long v, int base = DEC)     { return this->number(v, base, false); }
+    size_t print(long v, int base = DEC)              { return this->number((unsigned long)v, base, v < 0 && base == DEC); }
+    size_t print(unsigned int v, int base = DEC)      { return this->print((unsigned long)v, base); }
+    size_t print(int v, int base = DEC)               { return this->print((long)v, base); }
+    size_t print(unsigned char v, int base = DEC)     { return this->print((unsigned long)v, base); }
+    size_t print(double v, int digits = 2)
+    {
+      char b[32];
+      snprintf(b, sizeof(b), "%.*f", digits, v);
+      return this->print(b);
+    }
+
+    size_t println()                                  { return this->print("\r\n"); }
+    template<class T> size_t println(T v)             { size_t n = this->print(v); return n + this->println(); }
+    template<class T> size_t println(T v, int base)   { size_t n = this->print(v, base); return n + this->println(); }
+
+  protected:
+    size_t number(unsigned long v, int base, bool negative)
+    {
+      char b[24];
+      if(negative) snprintf(b, sizeof(b), "-%lu", (unsigned long)-(long)v);
+      else         snprintf(b, sizeof(b), base == HEX ? "%lX" : "%lu", v);
+      return this->print(b);
+    }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/** Serial - стандартный вывод. */
+
+class HostSerial : public Stream
+{
+  public:
+    void   begin(unsigned long) { }
+    size_t write(uint8_t b)     { return fputc(b, stdout) == EOF ? 0 : 1; }
+    using  Print::write;
+    int    available()          { return 0; }
+    int    read()               { return -1; }
+    int    peek()               { return -1; }
+    void   flush()              { fflush(stdout); }
+    operator bool()             { return true; }
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * Проверка библиотеки AlashUartMP3 на модели модуля AlashUartMP3Sim при сборке на компьютере.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include <AlashUartMP3.h>
+#include <AlashUartMP3FolderIndex.h>
+#include <AlashUartMP3Playlist.h>
+#include "AlashUartMP3Sim.h"
+
+static int failures = 0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); failures++; } } while(0)
+
+int main()
+{
+  AlashUartMP3Sim module(9600);
+  AlashUartMP3    mp3(module);
+
+  module.setMedia(120, 200, 4);
+  mp3.reset();
+
+  // Команды доходят до модуля, ответы разбираются
+  mp3.setVolume(50);
+  module.settle();
+  CHECK(module.volume() == 15);
+  mp3.setEqualizer(MP3_EQ_ROCK);
+  module.settle();
+  CHECK(module.equalizer() == MP3_EQ_ROCK);
+  CHECK(mp3.countFiles() == 120);
+
+  // Шаг громкости один и тот же с объединением и без: шаг модуля из 30, getVolume() - громкость модуля
+  mp3.volumeUp();
+  mp3.volumeUp();
+  module.settle();
+  CHECK(module.volume() == 17);
+  CHECK(mp3.getVolume() == 57);
+  mp3.setCoalescing(true);
+  mp3.volumeUp();
+  mp3.volumeUp();
+  mp3.volumeDn();
+  mp3.flush();
+  module.settle();
+  CHECK(module.volume() == 18);
+  CHECK(mp3.getVolume() == 60);
+  CHECK(mp3.getFramesSaved() == 2);
+  mp3.setCoalescing(false);
+
+  mp3.playFileByIndexNumber(5);
+  module.settle();
+  CHECK(module.currentIndex() == 5);
+  CHECK(mp3.getStatus() == MP3_STATUS_PLAYING);
+  CHECK(mp3.currentFileIndexNumber() == 5);
+  CHECK(mp3.currentFileLengthInSeconds() == 200);
+
+  mp3.pause();
+  CHECK(mp3.getStatus() == MP3_STATUS_PAUSED);
+  mp3.play();
+  delay(2500);
+  CHECK(mp3.currentFilePositionInSeconds() >= 2);
+
+  // Мусор с 0xAA перед ответом не съедает сам ответ
+  const uint8_t noise[] = { 0xAA, 0x0D, 0x02 };
+  module.injectNoise(noise, sizeof(noise));
+  CHECK(mp3.currentFileIndexNumber() == 5);
+
+  // Кадр, присланный модулем самостоятельно (отчёт о позиции, 0x25), не принимается за ответ
+  const uint8_t position[] = { 0, 0, 3 };
+  module.injectFrame(0x25, position, sizeof(position));
+  CHECK(mp3.countFiles() == 120);
+
+  // Потерянный ответ - таймаут, после него обмен продолжается
+  module.setFaults(1000, 0);
+  AlashUartMP3Request request;
+  mp3.requestStatus(request);
+  while(request.pending()) mp3.poll();
+  CHECK(request.result == MP3_RESULT_TIMEOUT);
+  module.setFaults(0, 0);
+  CHECK(mp3.getStatus() == MP3_STATUS_PLAYING);
+
+  // Снимок совпадает с отдельными запросами
+  AlashUartMP3Snapshot s;
+  CHECK(mp3.snapshot(s) == MP3_SNAPSHOT_ALL);
+  CHECK(s.status == MP3_STATUS_PLAYING);
+  CHECK(s.index == 5);
+  CHECK(s.length == 200);
+
+  // Отчёты о позиции, включённые снимком, после него не приходят
+  module.resetCounters();
+  uint32_t quietUntil = millis() + 2500;
+  while((int32_t)(millis() - quietUntil) < 0) mp3.poll();
+  CHECK(module.bytesSent == 0);
+
+  // Остановка
+  mp3.stop();
+  CHECK(mp3.getStatus() == MP3_STATUS_STOPPED);
+
+  // Список длиннее кадра не обрезается, а не отправляется
+  uint8_t sequence[MP3_SEQUENCE_MAX + 1];
+  memset(sequence, 1, sizeof(sequence));
+  module.resetCounters();
+  CHECK(mp3.playSequenceByFileNumber(sequence, sizeof(sequence)) == MP3_RESULT_TOO_LONG);
+  CHECK(module.framesReceived == 0);
+  CHECK(mp3.playSequenceByFileNumber(sequence, MP3_SEQUENCE_MAX) == MP3_RESULT_OK);
+  mp3.stop();
+  module.settle();
+
+  // Пауза посреди трека не открывает окно конца трека раньше времени: пока трек стоит, модуль не опрашивается
+  module.setMedia(20, 3, 0);
+  AlashUartMP3Playlist playlist(mp3);
+  const uint16_t tracks[] = { 4, 9 };
+  playlist.setTracks(tracks, 2);
+  playlist.start();
+  uint32_t until = millis() + 500;
+  while((int32_t)(millis() - until) < 0) playlist.update();
+  mp3.pause();
+  module.resetCounters();
+  until = millis() + 2500;
+  while((int32_t)(millis() - until) < 0) playlist.update();
+  CHECK(module.framesReceived <= 2);
+  mp3.play();
+  until = millis() + 4000;
+  while((int32_t)(millis() - until) < 0 && !playlist.tracksPlayed()) playlist.update();
+  CHECK(playlist.tracksPlayed() == 1);
+  module.settle();
+  CHECK(module.currentIndex() == 9);
+  playlist.stop();
+  module.setMedia(120, 200, 4);
+
+  // Каталог папок: номер FAT - только для папок, сверенных с именами
+  AlashUartMP3StaticFolderIndex<8> folders(mp3);
+  CHECK(folders.scan() == 4);
+  mp3.setFolderIndex(&folders);
+  CHECK(folders.fileIndex(2, 3) == 33);
+  CHECK(!folders.confirmed(2));
+  mp3.playFileNumberInFolderNumber(2, 3);
+  CHECK(!folders.confirmed(2));
+  mp3.flush();
+  CHECK(folders.confirmed(2));
+  CHECK(!folders.mismatched(2));
+  mp3.playFileNumberInFolderNumber(2, 4);
+  module.settle();
+  CHECK(module.currentIndex() == 34);
+
+  // Папка 258 - не папка 2 каталога: запуск по пути, такой папки нет
+  mp3.playFileNumberInFolderNumber(258, 3);
+  mp3.flush();
+  module.settle();
+  CHECK(module.currentIndex() == 34);
+
+  // Все файлы в корне, имена не "001"... - каталог не используется
+  module.setMedia(50, 200, 0);
+  folders.scan();
+  CHECK(folders.fileIndex(1, 3) == 0);
+  mp3.setFolderIndex(NULL);
+
+  // Только что включённый модуль теряет проверки готовности - настройки по умолчанию не отправляются повторно
+  module.setBootTime(500000UL);
+  module.powerOn();
+  module.resetCounters();
+  mp3.reset();
+  module.settle();
+  CHECK(module.volume() == 20);
+  CHECK(module.framesIgnored > 0);
+  uint32_t bootFrames = module.framesReceived;
+
+  // Потеряна только первая проверка - это может быть и потерянный ответ: настройки отправляются
+  module.setBootTime(10000UL);
+  module.powerOn();
+  module.resetCounters();
+  mp3.reset();
+  module.settle();
+  CHECK(module.framesIgnored == 1);
+  CHECK(module.framesReceived == bootFrames + 3);
+  module.resetCounters();
+  mp3.setVolume(50);
+  mp3.reset();
+  module.settle();
+  CHECK(module.volume() == 20);
+  CHECK(module.framesIgnored == 0);
+
+  // Тёплый старт без хранилища: настройки модуля неизвестны, шаг громкости уходит самому модулю
+  module.setBootTime(0);
+  mp3.setVolume(50);
+  module.settle();
+  AlashUartMP3 fresh(module);
+  CHECK(fresh.warmStart());
+  CHECK(fresh.getVolume() == MP3_SETTING_UNKNOWN);
+  CHECK(fresh.getLoopMode() == MP3_SETTING_UNKNOWN);
+  fresh.setCoalescing(true);
+  fresh.volumeUp();
+  fresh.volumeDn();
+  fresh.volumeDn();
+  fresh.flush();
+  module.settle();
+  CHECK(module.volume() == 14);
+  CHECK(fresh.getVolume() == MP3_SETTING_UNKNOWN);
+
+  printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+/**
+ * Запуск скетча (setup(), затем loop()) при сборке на компьютере.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+
+void setup();
+void loop();
+
+// Сколько раз вызвать loop(): скетчи-замеры всё делают в setup()
+#ifndef MP3_HOST_LOOPS
+  #define MP3_HOST_LOOPS 1
+#endif
+
+int main()
+{
+  setup();
+  for(unsigned long x = 0; x < MP3_HOST_LOOPS; x++)
+  {
+    loop();
+  }
+  Serial.flush();
+  return 0;
+}
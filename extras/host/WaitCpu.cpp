@@ -0,0 +1,168 @@
+/**
+ * Сколько процессора занимают блокирующие вызовы библиотеки AlashUartMP3 при разных способах ожидания
+ * (setWaitStrategy(), setWaitHandler()): настоящее время и потоки std::thread, сборка на компьютере.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ *
+ * Вызовы идут в отдельном потоке, как в задаче ESP32; поток "драйвера порта" раз в миллисекунду проверяет,
+ * пришли ли байты, и будит AlashUartMP3Notifier. cpu_percent - время процессора потока вызовов
+ * от времени на часах. Один модуль, блокирующие запросы статуса и номера файла:
+ *
+ *     wait,calls,wall_ms,cpu_ms,cpu_percent
+ *
+ * и группа из GROUP_MODULES модулей, команды без ответа и flush() группы:
+ *
+ *     group_wait,commands,wall_ms,cpu_ms,cpu_percent
+ */
+
+#include <Arduino.h>
+#include <AlashUartMP3.h>
+#include <AlashUartMP3Group.h>
+#include <AlashUartMP3Notifier.h>
+#include "AlashUartMP3Sim.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <time.h>
+
+const uint8_t  QUERIES       = 40; // Пар запросов на один способ ожидания
+const uint8_t  GROUP_MODULES = 2;
+const uint8_t  GROUP_ROUNDS  = 20; // Серий по две команды каждому модулю группы
+
+// Модель модуля, к которой обращаются два потока - вызовы библиотеки и "драйвер порта"
+class LockedPort : public Stream
+{
+  public:
+    LockedPort() : module(9600) { }
+
+    int    available()                      { std::lock_guard<std::mutex> l(lock); return module.available(); }
+    int    read()                           { std::lock_guard<std::mutex> l(lock); return module.read(); }
+    int    peek()                           { std::lock_guard<std::mutex> l(lock); return module.peek(); }
+    size_t write(uint8_t b)                 { std::lock_guard<std::mutex> l(lock); return module.write(b); }
+    size_t write(const uint8_t *b, size_t n) { std::lock_guard<std::mutex> l(lock); return module.write(b, n); }
+
+    AlashUartMP3Sim module;
+    std::mutex      lock;
+};
+
+LockedPort           ports[GROUP_MODULES];
+AlashUartMP3         *players[GROUP_MODULES];
+AlashUartMP3Notifier rxEvent;
+std::atomic<bool>    running(true);
+
+static double cpuMillis()
+{
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void printRow(const char *name, uint16_t calls, uint32_t wallMs, double cpuMs)
+{
+  printf("%s,%u,%lu,%.1f,%.1f\n", name, calls, (unsigned long)wallMs, cpuMs, wallMs ? 100.0 * cpuMs / wallMs : 0.0);
+}
+
+static void sleepHandler(uint32_t maxMicros, void *)
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(maxMicros));
+}
+
+// Способ ожидания для всех модулей: MP3_WAIT_... или 0xFF - уведомление драйвера порта
+static void setWait(uint8_t strategy)
+{
+  for(uint8_t m = 0; m < GROUP_MODULES; m++)
+  {
+    if(strategy == 0xFF)
+    {
+      players[m]->setWaitHandler(AlashUartMP3Notifier::wait, &rxEvent, true);
+    }
+    else
+    {
+      players[m]->setWaitStrategy(strategy);
+    }
+  }
+}
+
+static void measureSingle(const char *name)
+{
+  double   cpu   = cpuMillis();
+  uint32_t start = millis();
+  for(uint8_t x = 0; x < QUERIES; x++)
+  {
+    players[0]->getStatus();
+    players[0]->currentFileIndexNumber();
+  }
+  printRow(name, QUERIES * 2, millis() - start, cpuMillis() - cpu);
+}
+
+static void measureGroup(const char *name, AlashUartMP3Group &group)
+{
+  double   cpu   = cpuMillis();
+  uint32_t start = millis();
+  for(uint8_t x = 0; x < GROUP_ROUNDS; x++)
+  {
+    for(uint8_t m = 0; m < GROUP_MODULES; m++)
+    {
+      players[m]->setVolume(x % 2 ? 40 : 60);
+      players[m]->setEqualizer(x % 2 ? MP3_EQ_ROCK : MP3_EQ_POP);
+    }
+    group.flush();
+  }
+  printRow(name, GROUP_ROUNDS * GROUP_MODULES * 2, millis() - start, cpuMillis() - cpu);
+}
+
+int main()
+{
+  for(uint8_t m = 0; m < GROUP_MODULES; m++)
+  {
+    players[m] = new AlashUartMP3(ports[m]);
+  }
+
+  // "Событие приёма UART": драйвер порта проверяет приёмный буфер первого модуля раз в миллисекунду
+  std::thread uart([]()
+  {
+    while(running)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      if(ports[0].available()) rxEvent.notify();
+    }
+  });
+
+  std::thread task([]()
+  {
+    players[0]->reset();
+    for(uint8_t x = 0; x < 20; x++) players[0]->getStatus();
+
+    printf("wait,calls,wall_ms,cpu_ms,cpu_percent\n");
+    setWait(MP3_WAIT_SPIN);  measureSingle("spin");
+    setWait(MP3_WAIT_YIELD); measureSingle("yield");
+    setWait(MP3_WAIT_SLEEP); measureSingle("sleep");
+    setWait(0xFF);           measureSingle("notify");
+    players[0]->setWaitHandler(sleepHandler, NULL);
+    measureSingle("handler_sleep");
+
+    AlashUartMP3StaticGroup<GROUP_MODULES> group;
+    for(uint8_t m = 0; m < GROUP_MODULES; m++) group.add(*players[m]);
+    group.setAsync(true);
+
+    printf("group_wait,commands,wall_ms,cpu_ms,cpu_percent\n");
+    setWait(MP3_WAIT_SPIN);  measureGroup("spin",  group);
+    setWait(MP3_WAIT_SLEEP); measureGroup("sleep", group);
+  });
+
+  task.join();
+  running = false;
+  uart.join();
+
+  printf("# done\n");
+  return 0;
+}
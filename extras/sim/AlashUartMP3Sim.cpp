@@ -0,0 +1,697 @@
+/**
+ * Программная модель MP3-модуля JQ8400 для проверки библиотеки AlashUartMP3 без самого модуля.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3.h"
+#include "AlashUartMP3Sim.h"
+
+typedef AlashUartMP3 MP3; // Байты команд берём из таблицы драйвера
+
+// Время a наступило не позже времени b (с учётом переполнения micros())
+#define SIM_NOT_AFTER(a, b) ((int32_t)((a) - (b)) <= 0)
+
+AlashUartMP3Sim::AlashUartMP3Sim(uint32_t baud)
+{
+  setBaudRate(baud);
+  resetCounters();
+  lastUpdateAt = micros();
+  lastFrameEndAt = lastUpdateAt - 1000000UL;
+}
+
+void AlashUartMP3Sim::resetCounters()
+{
+  framesReceived  = 0;
+  framesIgnored   = 0;
+  checksumErrors  = 0;
+  bytesReceived   = 0;
+  bytesSent       = 0;
+  writeCalls      = 0;
+  tracksFinished  = 0;
+  trackGaps       = 0;
+  trackGapTotal   = 0;
+  trackGapMax     = 0;
+  outputOverflows = 0;
+  statusGlitches  = 0;
+}
+
+void AlashUartMP3Sim::setMedia(uint16_t files, uint16_t seconds, uint8_t folders)
+{
+  fileCount    = files;
+  trackSeconds = seconds;
+  folderCount  = folders;
+  index        = 1;
+  positionMs   = 0;
+  playState    = MP3_STATUS_STOPPED;
+}
+
+void AlashUartMP3Sim::powerOn()
+{
+  update();
+
+  pendingCount = 0;
+  outCount     = 0;
+  inState      = 0;
+  playState    = MP3_STATUS_STOPPED;
+  index        = 1;
+  positionMs   = 0;
+  positionUs   = 0;
+  moduleVolume = 20;
+  eq           = 0;
+  loop         = 2;
+  reporting    = false;
+  abStart      = 0;
+  abEnd        = 0;
+  interjected  = false;
+  silent       = false;
+
+  bootUntil = micros() + bootTime;
+  booting   = bootTime > 0;
+}
+
+int AlashUartMP3Sim::available()
+{
+  update();
+
+  // Доступны только байты, которые уже полностью "прошли" по линии
+  uint32_t now = micros();
+  int n = 0;
+  while(n < outCount && SIM_NOT_AFTER(outReadyAt[(outHead + n) % MP3_SIM_OUTPUT_SIZE], now))
+  {
+    n++;
+  }
+  return n;
+}
+
+int AlashUartMP3Sim::read()
+{
+  if(!available()) return -1;
+
+  uint8_t b = outBytes[outHead];
+  outHead = (outHead + 1) % MP3_SIM_OUTPUT_SIZE;
+  outCount--;
+  return b;
+}
+
+int AlashUartMP3Sim::peek()
+{
+  if(!available()) return -1;
+  return outBytes[outHead];
+}
+
+size_t AlashUartMP3Sim::write(uint8_t b)
+{
+  return write(&b, 1);
+}
+
+size_t AlashUartMP3Sim::write(const uint8_t *buffer, size_t size)
+{
+  update();
+  writeCalls++;
+
+  // Байты уходят в линию один за другим, модуль получает каждый по окончании его передачи
+  uint32_t now = micros();
+  if(SIM_NOT_AFTER(inLineFreeAt, now)) inLineFreeAt = now;
+
+  for(size_t x = 0; x < size; x++)
+  {
+    inLineFreeAt += byteTime;
+    bytesReceived++;
+    receiveByte(buffer[x], inLineFreeAt);
+  }
+
+  return size;
+}
+
+void AlashUartMP3Sim::injectFrame(uint8_t command, const uint8_t *data, uint8_t length)
+{
+  update();
+  sendFrame(command, data, length, micros());
+}
+
+void AlashUartMP3Sim::injectNoise(const uint8_t *data, uint8_t length)
+{
+  update();
+  uint32_t now = micros();
+  for(uint8_t x = 0; x < length; x++)
+  {
+    sendByte(data[x], now);
+  }
+}
+
+void AlashUartMP3Sim::receiveByte(uint8_t b, uint32_t at)
+{
+  // Разбор кадра AA [CMD] [LEN] [DATA] [SUM], как это делает модуль
+  switch(inState)
+  {
+    case 0:
+      if(b == MP3::MP3_CMD_BEGIN)
+      {
+        inChecksum = b;
+        inState    = 1;
+        // Кадр начался слишком быстро после предыдущего - модуль его не заметит
+        inTooEarly = minFrameGap && (int32_t)((at - byteTime) - (lastFrameEndAt + minFrameGap)) < 0;
+      }
+      return;
+
+    case 1:
+      inCommand   = b;
+      inChecksum += b;
+      inState     = 2;
+      return;
+
+    case 2:
+      inLength    = b;
+      inCount     = 0;
+      inChecksum += b;
+      inState     = inLength ? 3 : 4;
+      return;
+
+    case 3:
+      if(inCount < MP3_SIM_PAYLOAD_SIZE) inData[inCount] = b;
+      inCount++;
+      inChecksum += b;
+      if(inCount == inLength) inState = 4;
+      return;
+  }
+
+  inState = 0;
+  if(b != inChecksum)
+  {
+    checksumErrors++;
+    return;
+  }
+
+  if(inTooEarly)
+  {
+    framesIgnored++;
+    return;
+  }
+
+  // Модуль ещё загружается
+  if(booting)
+  {
+    if((int32_t)(at - bootUntil) < 0)
+    {
+      framesIgnored++;
+      return;
+    }
+    booting = false;
+  }
+
+  framesReceived++;
+  lastFrameEndAt = at;
+  if(pendingCount >= MP3_SIM_PENDING_SIZE)
+  {
+    // Модуль захлебнулся - команда потеряна
+    return;
+  }
+
+  Pending &p = pending[(pendingHead + pendingCount) % MP3_SIM_PENDING_SIZE];
+  p.dueAt   = at + responseLatency + (responseJitter ? (uint32_t)random(responseJitter + 1) : 0);
+  p.command = inCommand;
+  p.length  = inLength;
+  memcpy(p.data, inData, inLength < MP3_SIM_PAYLOAD_SIZE ? inLength : MP3_SIM_PAYLOAD_SIZE);
+  pendingCount++;
+}
+
+void AlashUartMP3Sim::update()
+{
+  uint32_t now = micros();
+
+  // События обрабатываем строго по времени: выполнение команд, окончание трека, отчёты о позиции
+  for(;;)
+  {
+    uint32_t nextAt   = now;
+    uint8_t  nextKind = 0;
+
+    if(pendingCount)
+    {
+      Pending &p = pending[pendingHead];
+      uint32_t at = SIM_NOT_AFTER(p.dueAt, busyUntil) ? busyUntil : p.dueAt;
+      if(SIM_NOT_AFTER(at, nextAt)) { nextAt = at; nextKind = 1; }
+    }
+
+    if(playState == MP3_STATUS_PLAYING)
+    {
+      uint32_t endMs = (abEnd > abStart) ? abEnd * 1000UL : trackSeconds * 1000UL;
+      uint32_t at    = lastUpdateAt;
+      if(endMs > positionMs) at += (endMs - positionMs) * 1000UL - positionUs;
+      if(SIM_NOT_AFTER(at, nextAt) && (!nextKind || at != nextAt)) { nextAt = at; nextKind = 2; }
+    }
+
+    if(reporting && SIM_NOT_AFTER(nextReportAt, nextAt) && (!nextKind || nextReportAt != nextAt))
+    {
+      nextAt = nextReportAt; nextKind = 3;
+    }
+
+    if(nextKind == 0) break;
+
+    advance(nextAt);
+
+    if(nextKind == 1)
+    {
+      Pending &p = pending[pendingHead];
+      pendingHead = (pendingHead + 1) % MP3_SIM_PENDING_SIZE;
+      pendingCount--;
+      busyUntil = nextAt;
+      execute(p, nextAt);
+    }
+    else if(nextKind == 2)
+    {
+      if(abEnd > abStart)
+      {
+        positionMs = abStart * 1000UL;
+        positionUs = 0;
+      }
+      else
+      {
+        trackEnded(nextAt);
+      }
+    }
+    else
+    {
+      sendTime(MP3::MP3_CMD_CURRENT_FILE_POS, positionMs / 1000, nextAt);
+      nextReportAt += 1000000UL;
+    }
+  }
+
+  advance(now);
+}
+
+void AlashUartMP3Sim::settle()
+{
+  do
+  {
+    update();
+  }
+  while(pendingCount || !SIM_NOT_AFTER(inLineFreeAt, micros()));
+}
+
+void AlashUartMP3Sim::advance(uint32_t at)
+{
+  // Воспроизведение могло начаться "в будущем" (модуль ещё ищет файл)
+  if(SIM_NOT_AFTER(at, lastUpdateAt)) return;
+
+  if(playState == MP3_STATUS_PLAYING)
+  {
+    positionUs += at - lastUpdateAt;
+    positionMs += positionUs / 1000;
+    positionUs %= 1000;
+  }
+  lastUpdateAt = at;
+}
+
+void AlashUartMP3Sim::startTrack(uint16_t fileIndex)
+{
+  if(fileIndex < 1 || fileIndex > fileCount) return;
+
+  // Тишина между окончанием предыдущего трека и этим (модель уже продвинута до момента запуска)
+  if(silent)
+  {
+    uint32_t gap = lastUpdateAt - endedAt;
+    trackGaps++;
+    trackGapTotal += gap;
+    if(gap > trackGapMax) trackGapMax = gap;
+    silent = false;
+  }
+
+  index      = fileIndex;
+  positionMs = 0;
+  positionUs = 0;
+  abStart    = abEnd = 0;
+  playState  = MP3_STATUS_PLAYING;
+}
+
+void AlashUartMP3Sim::trackEnded(uint32_t at)
+{
+  tracksFinished++;
+  positionMs = trackSeconds * 1000UL;
+  positionUs = 0;
+  silent     = true;
+  endedAt    = at;
+
+  if(trackEndCommand)
+  {
+    sendFrame(trackEndCommand, 0, 0, at);
+  }
+
+  // Объявление закончилось - возвращаемся к прерванной музыке
+  if(interjected)
+  {
+    interjected = false;
+    index       = resumeIndex;
+    positionMs  = resumeMs;
+    playState   = resumeState;
+    return;
+  }
+
+  uint8_t  folder = folderOf(index);
+  uint16_t first  = folderFirst(folder);
+  uint16_t last   = first + folderCountOf(folder) - 1;
+
+  switch(loop)
+  {
+    case MP3_LOOP_ONE:
+      startTrack(index);
+      return;
+
+    case MP3_LOOP_ALL:
+      startTrack(index < fileCount ? index + 1 : 1);
+      return;
+
+    case MP3_LOOP_ALL_STOP:
+      if(index < fileCount) startTrack(index + 1); else playState = MP3_STATUS_STOPPED;
+      return;
+
+    case MP3_LOOP_ALL_RANDOM:
+      startTrack(random(1, fileCount + 1));
+      return;
+
+    case MP3_LOOP_FOLDER:
+      startTrack(index < last ? index + 1 : first);
+      return;
+
+    case MP3_LOOP_FOLDER_RANDOM:
+      startTrack(random(first, last + 1));
+      return;
+
+    case MP3_LOOP_FOLDER_STOP:
+      if(index < last) startTrack(index + 1); else playState = MP3_STATUS_STOPPED;
+      return;
+
+    default: // MP3_LOOP_ONE_STOP
+      playState = MP3_STATUS_STOPPED;
+      return;
+  }
+}
+
+uint8_t AlashUartMP3Sim::folderOf(uint16_t fileIndex)
+{
+  if(!folderCount || !filesPerFolder()) return 0;
+  uint16_t folder = (fileIndex - 1) / filesPerFolder() + 1;
+  return folder > folderCount ? folderCount : folder;
+}
+
+uint16_t AlashUartMP3Sim::folderFirst(uint8_t folder)
+{
+  if(!folderCount || !folder) return 1;
+  return (folder - 1) * filesPerFolder() + 1;
+}
+
+uint16_t AlashUartMP3Sim::folderCountOf(uint8_t folder)
+{
+  if(!folderCount || !folder) return fileCount;
+  if(folder > folderCount) return 0;
+  return folder == folderCount ? fileCount - folderFirst(folder) + 1 : filesPerFolder();
+}
+
+void AlashUartMP3Sim::execute(Pending &p, uint32_t at)
+{
+  uint16_t arg16 = ((uint16_t)p.data[0] << 8) | p.data[1];
+
+  switch(p.command)
+  {
+    case MP3::MP3_CMD_STATUS:
+    {
+      uint8_t s = playState;
+      if(s != MP3_STATUS_STOPPED && statusGlitchRate && (uint16_t)random(1000) < statusGlitchRate)
+      {
+        s = s == MP3_STATUS_PLAYING ? MP3_STATUS_PAUSED : MP3_STATUS_PLAYING;
+        statusGlitches++;
+      }
+      sendFrame(p.command, &s, 1, at);
+      return;
+    }
+
+    case MP3::MP3_CMD_PLAY:
+      if(playState == MP3_STATUS_PAUSED) playState = MP3_STATUS_PLAYING;
+      else if(playState == MP3_STATUS_STOPPED) startTrack(index);
+      return;
+
+    case MP3::MP3_CMD_PAUSE:
+      if(playState == MP3_STATUS_PLAYING) playState = MP3_STATUS_PAUSED;
+      return;
+
+    case MP3::MP3_CMD_STOP:
+    case MP3::MP3_CMD_SLEEP:
+      silent      = false;
+      playState   = MP3_STATUS_STOPPED;
+      positionMs  = 0;
+      positionUs  = 0;
+      interjected = false;
+      return;
+
+    case MP3::MP3_CMD_PREV:
+      startTrack(index > 1 ? index - 1 : fileCount);
+      return;
+
+    case MP3::MP3_CMD_NEXT:
+      startTrack(index < fileCount ? index + 1 : 1);
+      return;
+
+    case MP3::MP3_CMD_PLAY_IDX:
+      startTrack(arg16);
+      return;
+
+    case MP3::MP3_CMD_SEEK_IDX:
+      if(arg16 >= 1 && arg16 <= fileCount)
+      {
+        index      = arg16;
+        positionMs = 0;
+        positionUs = 0;
+        playState  = MP3_STATUS_STOPPED;
+      }
+      return;
+
+    case MP3::MP3_CMD_INSERT_IDX:
+    {
+      uint16_t n = ((uint16_t)p.data[1] << 8) | p.data[2];
+      if(n < 1 || n > fileCount) return;
+      if(!interjected)
+      {
+        resumeIndex = index;
+        resumeMs    = positionMs;
+        resumeState = playState;
+      }
+      startTrack(n);
+      interjected = true;
+      return;
+    }
+
+    case MP3::MP3_CMD_PLAY_FILE_FOLDER:
+    {
+      // Путь вида " /03*/006*???" или " /03*/*???" (первый байт - источник)
+      uint8_t  stored = p.length < MP3_SIM_PAYLOAD_SIZE ? p.length : MP3_SIM_PAYLOAD_SIZE;
+      uint16_t numbers[2] = { 0, 0 };
+      int8_t   part = -1;
+      for(uint8_t x = 1; x < stored; x++)
+      {
+        if(p.data[x] == '/') { part++; continue; }
+        if(part >= 0 && part < 2 && p.data[x] >= '0' && p.data[x] <= '9')
+        {
+          numbers[part] = numbers[part] * 10 + (p.data[x] - '0');
+        }
+      }
+
+      uint16_t count = folderCountOf(numbers[0]);
+      if(!folderCount || !count) return;
+
+      uint16_t file  = numbers[1] ? numbers[1] : 1;
+      if(file > count) return;
+
+      uint16_t target = folderFirst(numbers[0]) + file - 1;
+
+      // Модуль ищет путь перебором FAT, пока ищет - ничего не делает
+      busyUntil = at + pathLookupLatency * target;
+      startTrack(target);
+      lastUpdateAt = busyUntil;
+      return;
+    }
+
+    case MP3::MP3_CMD_GET_SOURCES:
+      sendFrame(p.command, &sourcesMask, 1, at);
+      return;
+
+    case MP3::MP3_CMD_GET_SOURCE:
+      sendFrame(p.command, &currentSource, 1, at);
+      return;
+
+    case MP3::MP3_CMD_SOURCE_SET:
+      if(sourcesMask & (1 << p.data[0]))
+      {
+        currentSource = p.data[0];
+        index         = 1;
+        positionMs    = 0;
+        playState     = MP3_STATUS_STOPPED;
+      }
+      return;
+
+    case MP3::MP3_CMD_COUNT_FILES:
+      sendUnsignedInt(p.command, fileCount, at);
+      return;
+
+    case MP3::MP3_CMD_CURRENT_FILE_IDX:
+      sendUnsignedInt(p.command, index, at);
+      return;
+
+    case MP3::MP3_CMD_PREV_FOLDER:
+    {
+      uint8_t folder = folderOf(index);
+      startTrack(folderFirst(folder > 1 ? folder - 1 : folderCount));
+      return;
+    }
+
+    case MP3::MP3_CMD_NEXT_FOLDER:
+    {
+      uint8_t folder = folderOf(index);
+      startTrack(folderFirst(folder < folderCount ? folder + 1 : 1));
+      return;
+    }
+
+    case MP3::MP3_CMD_FIRST_FILE_IN_FOLDER_IDX:
+      sendUnsignedInt(p.command, folderFirst(folderOf(index)), at);
+      return;
+
+    case MP3::MP3_CMD_COUNT_IN_FOLDER:
+      sendUnsignedInt(p.command, folderCountOf(folderOf(index)), at);
+      return;
+
+    case MP3::MP3_CMD_VOL_SET:
+      moduleVolume = p.data[0] > 30 ? 30 : p.data[0];
+      return;
+
+    case MP3::MP3_CMD_VOL_UP:
+      if(moduleVolume < 30) moduleVolume++;
+      return;
+
+    case MP3::MP3_CMD_VOL_DN:
+      if(moduleVolume > 0) moduleVolume--;
+      return;
+
+    case MP3::MP3_CMD_LOOP_SET:
+      loop = p.data[0];
+      return;
+
+    case MP3::MP3_CMD_EQ_SET:
+      eq = p.data[0];
+      return;
+
+    case MP3::MP3_CMD_PLAYLIST:
+      // Файлы папки ZH отдельно не моделируются, просто играем текущий
+      if(p.length >= 2) startTrack(index);
+      return;
+
+    case MP3::MP3_CMD_CURRENT_FILE_NAME:
+    {
+      // Имя 8.3 без точки: "006     MP3" для файла в папке, "0042    MP3" в корне
+      char name[12];
+      uint8_t folder = folderOf(index);
+      if(folder)
+      {
+        snprintf(name, sizeof(name), "%03u     MP3", (unsigned)((index - folderFirst(folder) + 1) % 1000));
+      }
+      else
+      {
+        snprintf(name, sizeof(name), "%04u    MP3", (unsigned)(index % 10000));
+      }
+      sendFrame(p.command, (const uint8_t *)name, 11, at);
+      return;
+    }
+
+    case MP3::MP3_CMD_AB_PLAY:
+      if(playState == MP3_STATUS_PLAYING)
+      {
+        abStart = p.data[0] * 60 + p.data[1];
+        abEnd   = p.data[2] * 60 + p.data[3];
+      }
+      return;
+
+    case MP3::MP3_CMD_AB_PLAY_STOP:
+      abStart = abEnd = 0;
+      return;
+
+    case MP3::MP3_CMD_RWND:
+      positionMs = positionMs > arg16 * 1000UL ? positionMs - arg16 * 1000UL : 0;
+      return;
+
+    case MP3::MP3_CMD_FFWD:
+      positionMs += arg16 * 1000UL;
+      if(positionMs > trackSeconds * 1000UL) positionMs = trackSeconds * 1000UL;
+      return;
+
+    case MP3::MP3_CMD_CURRENT_FILE_LEN:
+      sendTime(p.command, trackSeconds, at);
+      return;
+
+    case MP3::MP3_CMD_CURRENT_FILE_POS:
+      // Сразу отвечаем, а дальше - каждую секунду
+      reporting    = true;
+      nextReportAt = at + 1000000UL;
+      sendTime(p.command, positionMs / 1000, at);
+      return;
+
+    case MP3::MP3_CMD_CURRENT_FILE_POS_STOP:
+      reporting = false;
+      return;
+  }
+}
+
+void AlashUartMP3Sim::sendTime(uint8_t command, uint32_t seconds, uint32_t at)
+{
+  uint8_t buf[3] = { (uint8_t)(seconds / 3600), (uint8_t)((seconds / 60) % 60), (uint8_t)(seconds % 60) };
+  sendFrame(command, buf, 3, at);
+}
+
+void AlashUartMP3Sim::sendUnsignedInt(uint8_t command, uint16_t value, uint32_t at)
+{
+  uint8_t buf[2] = { (uint8_t)(value >> 8), (uint8_t)(value & 0xFF) };
+  sendFrame(command, buf, 2, at);
+}
+
+void AlashUartMP3Sim::sendFrame(uint8_t command, const uint8_t *data, uint8_t length, uint32_t at)
+{
+  uint8_t sum = MP3::MP3_CMD_BEGIN + command + length;
+
+  sendByte(MP3::MP3_CMD_BEGIN, at);
+  sendByte(command, at);
+  sendByte(length, at);
+  for(uint8_t x = 0; x < length; x++)
+  {
+    sum += data[x];
+    sendByte(data[x], at);
+  }
+  sendByte(sum, at);
+}
+
+void AlashUartMP3Sim::sendByte(uint8_t b, uint32_t at)
+{
+  if(SIM_NOT_AFTER(outLineFreeAt, at)) outLineFreeAt = at;
+  outLineFreeAt += byteTime;
+  bytesSent++;
+
+  // Помехи на линии
+  if(dropRate && (uint16_t)random(1000) < dropRate) return;
+  if(corruptRate && (uint16_t)random(1000) < corruptRate) b ^= 1 << random(8);
+
+  if(outCount >= MP3_SIM_OUTPUT_SIZE)
+  {
+    outputOverflows++;
+    return;
+  }
+
+  uint16_t i = (outHead + outCount) % MP3_SIM_OUTPUT_SIZE;
+  outBytes[i]   = b;
+  outReadyAt[i] = outLineFreeAt;
+  outCount++;
+}
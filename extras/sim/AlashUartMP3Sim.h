@@ -0,0 +1,295 @@
+/**
+ * Программная модель MP3-модуля JQ8400 для проверки библиотеки AlashUartMP3 без самого модуля.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Sim_h
+#define AlashUartMP3Sim_h
+
+// Сколько байтов модуль может "держать в линии" в сторону контроллера
+#ifndef MP3_SIM_OUTPUT_SIZE
+  #define MP3_SIM_OUTPUT_SIZE 256
+#endif
+
+// Сколько принятых, но ещё не выполненных команд помнит модель
+#define MP3_SIM_PENDING_SIZE 8
+
+// Сколько байтов данных команды сохраняется для выполнения (путь к файлу в папке - 13 байтов)
+#define MP3_SIM_PAYLOAD_SIZE 16
+
+/** Модель модуля JQ8400, подключаемая вместо последовательного порта.
+ *
+ *  Реализует интерфейс Stream, поэтому передаётся в AlashUartMP3 как обычный порт:
+ *
+ *      #include <AlashUartMP3.h>
+ *      #include "AlashUartMP3Sim.h"   // скопирован в папку скетча
+ *
+ *      AlashUartMP3Sim module;         // 9600 бод, как у настоящего модуля
+ *      AlashUartMP3    mp3(module);
+ *
+ *      void setup()
+ *      {
+ *        module.setMedia(120, 200, 4); // 120 файлов по 200 секунд в 4 папках
+ *        mp3.reset();
+ *        mp3.playFileByIndexNumber(5);
+ *      }
+ *
+ *  Модель отрабатывает все команды из таблицы MP3_CMD_... (от MP3_CMD_PLAY до MP3_CMD_PLAYLIST),
+ *  ведёт воспроизведение во времени (позиция, окончание трека по режиму цикла), присылает
+ *  отчёты о позиции, а также умеет:
+ *
+ *   * передавать байты с задержкой, соответствующей скорости порта (`setBaudRate()`);
+ *   * отвечать с задержкой обработки команды (`setResponseLatency()`, `setPathLookupLatency()`);
+ *   * пропускать команды, идущие слишком плотно друг за другом (`setMinFrameGap()`);
+ *   * загружаться после включения питания, не замечая команд (`setBootTime()`, `powerOn()`);
+ *   * терять и портить байты ответа (`setFaults()`);
+ *   * присылать кадры и мусор сами по себе (`injectFrame()`, `injectNoise()`, `setTrackEndNotification()`).
+ *
+ *  Время берётся из `micros()`, так что модель работает и на плате (например, ESP32),
+ *  и на компьютере - с заменой Arduino.h из extras/host (см. extras/host/CMakeLists.txt).
+ */
+
+class AlashUartMP3Sim : public Stream
+{
+  public:
+
+    /** Создание модели модуля.
+     *
+     * @param baud Скорость порта, 0 - байты передаются мгновенно.
+     */
+
+    AlashUartMP3Sim(uint32_t baud = 9600);
+
+    /** @name Интерфейс Stream
+     */
+    ///@{
+    virtual int    available();
+    virtual int    read();
+    virtual int    peek();
+    virtual size_t write(uint8_t b);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual void   flush() { }
+    using Print::write;
+    ///@}
+
+    /** @name Настройка модели
+     */
+    ///@{
+
+    /** Скорость порта (8N1, 10 бит на байт), 0 - без задержек передачи. */
+
+    void setBaudRate(uint32_t baud) { byteTime = baud ? 10000000UL / baud : 0; }
+
+    /** Задержка между приёмом команды и началом её выполнения (ответа), мкс. */
+
+    void setResponseLatency(uint32_t micros) { responseLatency = micros; }
+
+    /** Случайная добавка к задержке каждой команды, от 0 до micros мкс (модуль то быстрее, то медленнее). */
+
+    void setResponseJitter(uint32_t micros) { responseJitter = micros; }
+
+    /** Дополнительная задержка поиска файла по пути (MP3_CMD_PLAY_FILE_FOLDER) на каждый
+     *  файл, стоящий в FAT перед искомым, мкс - модуль ищет путь перебором FAT.
+     */
+
+    void setPathLookupLatency(uint32_t microsPerFile) { pathLookupLatency = microsPerFile; }
+
+    /** Минимальная пауза между концом одного кадра команды и началом следующего, мкс.
+     *
+     *  Кадр, начавшийся раньше, модуль пропускает (`framesIgnored`) - так проверяется,
+     *  какая пауза между командами действительно нужна (`AlashUartMP3::setInterFrameGap()`).
+     */
+
+    void setMinFrameGap(uint32_t micros) { minFrameGap = micros; }
+
+    /** Потеря и порча байтов, передаваемых модулем (на тысячу байтов). */
+
+    void setFaults(uint16_t dropPerMille, uint16_t corruptPerMille) { dropRate = dropPerMille; corruptRate = corruptPerMille; }
+
+    /** Как часто (на тысячу запросов) модуль сообщает не тот статус: воспроизведение вместо паузы и наоборот.
+     *
+     *  Остановку модуль сообщает верно - так ведёт себя и настоящий JQ8400 (см. `AlashUartMP3::setStatusChecks()`).
+     */
+
+    void setStatusGlitches(uint16_t perMille) { statusGlitchRate = perMille; }
+
+    /** Сколько модуль загружается после включения питания (`powerOn()`), мкс.
+     *
+     *  Кадры, пришедшие за это время, модуль пропускает (`framesIgnored`).
+     */
+
+    void setBootTime(uint32_t micros) { bootTime = micros; }
+
+    /** Включение питания: модуль начинает загружаться (`setBootTime()`), воспроизведение, громкость,
+     *  эквалайзер и режим цикла - как у только что включённого модуля, принятые команды и неотправленные ответы теряются.
+     */
+
+    void powerOn();
+
+    /** Содержимое носителя.
+     *
+     *  Файлы нумеруются в FAT от 1 до fileCount и поровну раскладываются по папкам
+     *  "01", "02"... (остаток - в последнюю), внутри папки файлы называются 001.mp3, 002.mp3...
+     *
+     * @param fileCount    Количество файлов.
+     * @param trackSeconds Длина каждого файла, секунды.
+     * @param folderCount  Количество папок (0 - все файлы в корне).
+     */
+
+    void setMedia(uint16_t fileCount, uint16_t trackSeconds = 180, uint8_t folderCount = 0);
+
+    /** Доступные источники (битовая маска, как у getAvailableSources()) и выбранный источник. */
+
+    void setSources(uint8_t availableMask, uint8_t current) { sourcesMask = availableMask; currentSource = current; }
+
+    /** Присылать кадр с заданным байтом команды (без данных) по окончании каждого трека, 0 - не присылать (как настоящий JQ8400). */
+
+    void setTrackEndNotification(uint8_t command) { trackEndCommand = command; }
+
+    /** Прислать кадр так, как будто модуль отправил его сам. */
+
+    void injectFrame(uint8_t command, const uint8_t *data, uint8_t length);
+
+    /** Прислать произвольные байты (мусор на линии). */
+
+    void injectNoise(const uint8_t *data, uint8_t length);
+
+    ///@}
+
+    /** @name Состояние модели
+     */
+    ///@{
+    uint8_t  status()          { update(); return playState; }  ///< MP3_STATUS_...
+    uint8_t  volume()          { return moduleVolume; }         ///< Громкость модуля 0-30
+    uint8_t  equalizer()       { return eq; }
+    uint8_t  loopMode()        { return loop; }
+    uint8_t  source()          { return currentSource; }
+    uint16_t currentIndex()    { return index; }
+    uint16_t positionSeconds() { update(); return positionMs / 1000; }
+
+    uint32_t framesReceived;   ///< Принято правильных кадров команд
+    uint32_t checksumErrors;   ///< Принято кадров с неверной контрольной суммой
+    uint32_t framesIgnored;    ///< Пропущено кадров, пришедших без нужной паузы после предыдущего или во время загрузки
+    uint32_t bytesReceived;    ///< Принято байтов от контроллера
+    uint32_t bytesSent;        ///< Передано байтов контроллеру (включая потерянные)
+    uint32_t writeCalls;       ///< Вызовов write() со стороны контроллера
+    uint32_t tracksFinished;   ///< Сколько треков доиграло до конца
+    uint32_t trackGaps;        ///< Сколько раз после окончания трека запускался следующий
+    uint32_t trackGapTotal;    ///< Суммарная тишина между окончанием трека и запуском следующего, мкс
+    uint32_t trackGapMax;      ///< Самая длинная такая тишина, мкс
+    uint32_t outputOverflows;  ///< Байтов, не поместившихся в буфер передачи
+    uint32_t statusGlitches;   ///< Сколько раз сообщён неверный статус (setStatusGlitches())
+
+    /** Сброс счётчиков. */
+
+    void resetCounters();
+    ///@}
+
+    /** Продвижение модели до текущего момента (вызывается автоматически из available()/read()/write()). */
+
+    void update();
+
+    /** Ожидание, пока модуль не получит все отправленные ему байты и не выполнит принятые команды. */
+
+    void settle();
+
+  protected:
+
+    struct Pending
+    {
+      uint32_t dueAt;                          ///< Когда выполнить, мкс
+      uint8_t  command;
+      uint8_t  length;                         ///< Длина данных в кадре (может быть больше сохранённой)
+      uint8_t  data[MP3_SIM_PAYLOAD_SIZE];
+    };
+
+    // Передача модуль -> контроллер
+    uint8_t  outBytes[MP3_SIM_OUTPUT_SIZE];
+    uint32_t outReadyAt[MP3_SIM_OUTPUT_SIZE];  ///< Когда байт полностью принят контроллером, мкс
+    uint16_t outHead  = 0;
+    uint16_t outCount = 0;
+    uint32_t outLineFreeAt = 0;
+
+    // Передача контроллер -> модуль
+    uint32_t inLineFreeAt = 0;
+    uint8_t  inState    = 0;
+    uint8_t  inCommand  = 0;
+    uint8_t  inLength   = 0;
+    uint8_t  inCount    = 0;
+    uint8_t  inChecksum = 0;
+    bool     inTooEarly = false;
+    uint32_t lastFrameEndAt = 0;               ///< Когда закончился последний принятый кадр, мкс
+    uint8_t  inData[MP3_SIM_PAYLOAD_SIZE];
+
+    Pending  pending[MP3_SIM_PENDING_SIZE];
+    uint8_t  pendingHead  = 0;
+    uint8_t  pendingCount = 0;
+    uint32_t busyUntil    = 0;                 ///< Модуль занят выполнением предыдущей команды до, мкс
+
+    // Настройки
+    uint32_t byteTime;
+    uint32_t responseLatency   = 2000;
+    uint32_t responseJitter    = 0;
+    uint32_t pathLookupLatency = 0;
+    uint32_t minFrameGap       = 0;
+    uint16_t dropRate          = 0;
+    uint16_t corruptRate       = 0;
+    uint16_t statusGlitchRate  = 0;
+    uint32_t bootTime          = 0;
+    uint32_t bootUntil         = 0;            ///< До какого момента модуль загружается, мкс
+    bool     booting           = false;
+    uint8_t  trackEndCommand   = 0;
+
+    // Носитель
+    uint16_t fileCount    = 10;
+    uint16_t trackSeconds = 180;
+    uint8_t  folderCount  = 0;
+    uint8_t  sourcesMask  = 0x06;              ///< SD и встроенная память
+    uint8_t  currentSource = 1;                ///< MP3_SRC_SDCARD
+
+    // Воспроизведение
+    uint8_t  playState    = 0;                 ///< MP3_STATUS_...
+    uint16_t index        = 1;
+    uint32_t positionMs   = 0;
+    uint32_t positionUs   = 0;                 ///< Доли миллисекунды позиции
+    uint32_t lastUpdateAt = 0;
+    uint8_t  moduleVolume = 20;
+    uint8_t  eq           = 0;
+    uint8_t  loop         = 2;
+    bool     reporting    = false;
+    uint32_t nextReportAt = 0;
+    uint16_t abStart      = 0;
+    uint16_t abEnd        = 0;
+    bool     interjected  = false;
+    uint16_t resumeIndex  = 0;
+    uint32_t resumeMs     = 0;
+    bool     silent       = false;             ///< Трек закончился, следующий ещё не запущен
+    uint32_t endedAt      = 0;                 ///< Когда закончился последний трек, мкс
+    uint8_t  resumeState  = 0;
+
+    void     receiveByte(uint8_t b, uint32_t at);
+    void     execute(Pending &p, uint32_t at);
+    void     advance(uint32_t at);
+    void     trackEnded(uint32_t at);
+    void     startTrack(uint16_t fileIndex);
+    void     sendFrame(uint8_t command, const uint8_t *data, uint8_t length, uint32_t at);
+    void     sendByte(uint8_t b, uint32_t at);
+    void     sendTime(uint8_t command, uint32_t seconds, uint32_t at);
+    void     sendUnsignedInt(uint8_t command, uint16_t value, uint32_t at);
+
+    uint16_t filesPerFolder() { return folderCount ? fileCount / folderCount : fileCount; }
+    uint8_t  folderOf(uint16_t fileIndex);
+    uint16_t folderFirst(uint8_t folder);
+    uint16_t folderCountOf(uint8_t folder);
+};
+
+#endif
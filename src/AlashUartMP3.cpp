@@ -14,36 +14,42 @@
 
 #include <Arduino.h>
 #include "AlashUartMP3.h"
+#include "AlashUartMP3FolderIndex.h"
+#include "AlashUartMP3Group.h"
+#include "AlashUartMP3Store.h"
+
+// Первый байт записи настроек в хранилище: признак и версия формата записи
+#define MP3_STORE_MAGIC 0xA1
 
 void  AlashUartMP3::play()
 {
-  this->sendCommand(MP3_CMD_PLAY);
+  this->sendFixedCommand<MP3_CMD_PLAY>();
 }
 
 void  AlashUartMP3::restart()
 {
-  this->sendCommand(MP3_CMD_STOP); // Убеждаемся, что действительно перезапустится
-  this->sendCommand(MP3_CMD_PLAY);
+  this->sendFixedCommand<MP3_CMD_STOP>(); // Убеждаемся, что действительно перезапустится
+  this->sendFixedCommand<MP3_CMD_PLAY>();
 }
 
 void  AlashUartMP3::pause()
 {
-  this->sendCommand(MP3_CMD_PAUSE);
+  this->sendFixedCommand<MP3_CMD_PAUSE>();
 }
 
 void  AlashUartMP3::stop()
 {
-  this->sendCommand(MP3_CMD_STOP);
+  this->sendFixedCommand<MP3_CMD_STOP>();
 }
 
 void  AlashUartMP3::next()
 {
-  this->sendCommand(MP3_CMD_NEXT);
+  this->sendFixedCommand<MP3_CMD_NEXT>();
 }
 
 void  AlashUartMP3::prev()
 {
-  this->sendCommand(MP3_CMD_PREV);
+  this->sendFixedCommand<MP3_CMD_PREV>();
 }
 
 void  AlashUartMP3::playFileByIndexNumber(uint16_t fileNumber)
@@ -54,7 +60,7 @@ void  AlashUartMP3::playFileByIndexNumber(uint16_t fileNumber)
 
 void  AlashUartMP3::interjectFileByIndexNumber(uint16_t fileNumber)
 {  
-  uint8_t buf[3] = { getSource(), (uint8_t)((fileNumber>>8)&0xFF), (uint8_t)(fileNumber & (byte)0xFF) };
+  uint8_t buf[3] = { activeSource(), (uint8_t)((fileNumber>>8)&0xFF), (uint8_t)(fileNumber & (byte)0xFF) };
   this->sendCommandData(MP3_CMD_INSERT_IDX, buf, 3, 0, 0);
 }
 
@@ -72,7 +78,7 @@ void AlashUartMP3::abLoopPlay(uint16_t secondsStart, uint16_t secondsEnd)
 
 void AlashUartMP3::abLoopClear()
 {
-  this->sendCommand(MP3_CMD_AB_PLAY_STOP);
+  this->sendFixedCommand<MP3_CMD_AB_PLAY_STOP>();
 }
 
 void AlashUartMP3::fastForward(uint16_t seconds)
@@ -89,16 +95,24 @@ void AlashUartMP3::rewind(uint16_t seconds)
 
 void  AlashUartMP3::nextFolder()
 {
-  this->sendCommand(MP3_CMD_NEXT_FOLDER);
+  this->sendFixedCommand<MP3_CMD_NEXT_FOLDER>();
 }
 
 void  AlashUartMP3::prevFolder()
 {
-  this->sendCommand(MP3_CMD_PREV_FOLDER);
+  this->sendFixedCommand<MP3_CMD_PREV_FOLDER>();
 }
 
 void  AlashUartMP3::playFileNumberInFolderNumber(uint16_t folderNumber, uint16_t fileNumber)
 {
+  // Папка есть в каталоге и сверена с именем - номер FAT уже известен, модулю не нужно искать путь
+  uint16_t fileIndex = this->folderFileIndex(folderNumber, fileNumber);
+  if(fileIndex && folderIndex->confirmed(folderNumber))
+  {
+    this->playFileByIndexNumber(fileIndex);
+    return;
+  }
+  
   // Это довольно странно, символ подстановки *ОБЯЗАТЕЛЕН*, без него файл НЕ БУДЕТ найден.
   //
   // Действительно странно. В любом случае, это формат данных:
@@ -109,7 +123,7 @@ void  AlashUartMP3::playFileNumberInFolderNumber(uint16_t folderNumber, uint16_t
   
   char buf[] = " /42*/032*???";
   
-  buf[0] = this->getSource();
+  buf[0] = this->activeSource();
   
   uint8_t i = 2; // 1-я цифра компонента папки
   if(folderNumber<10)
@@ -138,14 +152,21 @@ void  AlashUartMP3::playFileNumberInFolderNumber(uint16_t folderNumber, uint16_t
   
   buf[9] = '*'; // itoa затерла это своим null
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, sizeof(buf)-1, 0, 0);
+  this->playFolderPath((uint8_t*)buf, sizeof(buf)-1, folderNumber, fileIndex);
 }
 
 void  AlashUartMP3::playInFolderNumber(uint16_t folderNumber)
 {
+  uint16_t fileIndex = this->folderFileIndex(folderNumber, 1);
+  if(fileIndex && folderIndex->confirmed(folderNumber))
+  {
+    this->playFileByIndexNumber(fileIndex);
+    return;
+  }
+  
   char buf[] = " /42*/*???";
   
-  buf[0] = this->getSource();
+  buf[0] = this->activeSource();
   
   uint8_t i = 2; // 1-я цифра компонента папки
   if(folderNumber<10)
@@ -158,54 +179,165 @@ void  AlashUartMP3::playInFolderNumber(uint16_t folderNumber)
   i = 4;
   buf[i] = '*'; // itoa затерла это своим null
   
-  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, (uint8_t*)buf, sizeof(buf)-1, 0, 0);
+  this->playFolderPath((uint8_t*)buf, sizeof(buf)-1, folderNumber, fileIndex);
 }
 
-void AlashUartMP3::playSequenceByFileNumber(uint8_t playList[], uint8_t listLength)
+uint16_t AlashUartMP3::folderFileIndex(uint16_t folderNumber, uint16_t fileNumber)
 {
-  char buf[listLength*2+1]; // itoa потребует дополнительный null
-  
-  uint8_t i = 0;
-  for(uint8_t x = 0; x < listLength; x++)
+  // Каталог знает только папки 0-255, остальные - по пути
+  if(!folderIndex || folderNumber > 0xFF) return 0;
+  return folderIndex->fileIndex(folderNumber, fileNumber);
+}
+
+void  AlashUartMP3::playFolderPath(uint8_t *path, uint8_t length, uint16_t folderNumber, uint16_t fileIndex)
+{
+  // Первый запуск из папки каталога идёт по пути: номер файла спрашиваем до и после запуска,
+  //  а сверяет ответы folderChecked() из poll() - запуск этим не задерживается.
+  //  Если сверка предыдущей папки ещё идёт или очередь заполнена, сверим в следующий раз
+  bool check = fileIndex && !folderBefore.pending() && !folderAfter.pending()
+            && this->queueRequest(MP3_CMD_CURRENT_FILE_IDX, folderBefore);
+  if(check)
   {
-    if(playList[x]<10)
-    {
-      buf[i++] = '0';
-    }
-    itoa(playList[x], &buf[i++], 10);
+    checkFolder = folderNumber;
+    checkIndex  = fileIndex;
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (uint8_t *)buf, sizeof(buf)-1, 0, 0);
+  this->sendCommandData(MP3_CMD_PLAY_FILE_FOLDER, path, length, 0, 0);
+  
+  if(check)
+  {
+    this->queueRequest(MP3_CMD_CURRENT_FILE_IDX, folderAfter);
+  }
 }
 
-void AlashUartMP3::playSequenceByFileName(const char * playList[], uint8_t listLength)
+void  AlashUartMP3::folderChecked(AlashUartMP3Request &request)
 {
-  char buf[listLength*2];
+  AlashUartMP3 *mp3 = (AlashUartMP3*)request.context;
+  AlashUartMP3FolderIndex *index = mp3->folderIndex;
+  if(!index || request.result != MP3_RESULT_OK) return;
   
-  uint8_t i = 0;
-  for(uint8_t x = 0; x < listLength; x++)
+  uint16_t found = request.asUnsignedInt();
+  if(found == mp3->checkIndex)
   {
-    buf[i++] = playList[x][0];
-    buf[i++] = playList[x][1];
+    index->confirm(mp3->checkFolder, true);
+    return;
   }
   
-  this->sendCommandData(MP3_CMD_PLAYLIST, (uint8_t *)buf, sizeof(buf), 0, 0);
+  // Модуль ещё ищет путь и назвал прежний файл, или нашёл файл вне этой папки по каталогу
+  //  (например, все папки сдвинуты файлами в корне) - такой ответ против папки не считаем
+  uint16_t first = index->folderFirstIndex(mp3->checkFolder);
+  if(mp3->folderBefore.result != MP3_RESULT_OK || found == mp3->folderBefore.asUnsignedInt()) return;
+  if(found < first || found >= first + index->folderFileCount(mp3->checkFolder)) return;
+  
+  index->confirm(mp3->checkFolder, false);
+}
+
+uint8_t AlashUartMP3::playSequenceByFileNumber(uint8_t playList[], uint8_t listLength)
+{
+  return this->sendCommandGenerated(MP3_CMD_PLAYLIST, listLength * 2, numberListByte, playList);
+}
+
+uint8_t AlashUartMP3::playSequenceByFileNumber_P(const uint8_t *playList, uint8_t listLength)
+{
+  return this->sendCommandGenerated(MP3_CMD_PLAYLIST, listLength * 2, numberListByte_P, (void *)playList);
+}
+
+uint8_t AlashUartMP3::playSequenceByFileName(const char *playList[], uint8_t listLength)
+{
+  return this->sendCommandGenerated(MP3_CMD_PLAYLIST, listLength * 2, nameListByte, (void *)playList);
+}
+
+uint8_t AlashUartMP3::playSequence(MP3SequenceSource source, uint8_t listLength, void *context)
+{
+  // Вызов блокирующий, поэтому описание источника может лежать на стеке
+  SequenceSource sequence = { source, context };
+  return this->sendCommandGenerated(MP3_CMD_PLAYLIST, listLength * 2, sequenceByte, &sequence);
+}
+
+// Номер файла 0-99 в виде двух цифр: первый байт - десятки, второй - единицы
+uint8_t AlashUartMP3::numberListByte(uint8_t offset, void *context)
+{
+  uint8_t number = ((uint8_t *)context)[offset / 2];
+  return '0' + (offset % 2 ? number % 10 : number / 10 % 10);
+}
+
+uint8_t AlashUartMP3::numberListByte_P(uint8_t offset, void *context)
+{
+  uint8_t number = pgm_read_byte((const uint8_t *)context + offset / 2);
+  return '0' + (offset % 2 ? number % 10 : number / 10 % 10);
+}
+
+uint8_t AlashUartMP3::nameListByte(uint8_t offset, void *context)
+{
+  return ((const char **)context)[offset / 2][offset % 2];
+}
+
+uint8_t AlashUartMP3::sequenceByte(uint8_t offset, void *context)
+{
+  SequenceSource *sequence = (SequenceSource *)context;
+  
+  // Источник спрашивается по разу на каждый байт, две цифры одного файла - два вызова
+  uint8_t number = sequence->source(offset / 2, sequence->context);
+  return '0' + (offset % 2 ? number % 10 : number / 10 % 10);
 }
 
 void  AlashUartMP3::volumeUp()
 {
-  if(currentVolume < 100) currentVolume++;
-  // Конвертируем 0-100 в 0-30 для модуля
-  uint8_t moduleVolume = (currentVolume * 30) / 100;
-  this->sendCommand(MP3_CMD_VOL_UP); // Мы не можем запросить громкость с устройства, поэтому отслеживаем её локально
+  // Шаг - один из 30 шагов модуля, как у VOL_UP; громкость 0-100 пересчитывается из громкости модуля
+  //  с округлением вверх, чтобы обратный пересчёт (setVolume(), хранилище) дал ту же громкость модуля
+  uint8_t moduleVolume = this->volumeOnModule();
+  if(moduleVolume != MP3_STATE_UNKNOWN)
+  {
+    if(moduleVolume < 30) moduleVolume++;
+    currentVolume = (moduleVolume * 100 + 29) / 30;
+  }
+  this->stateChanged();
+  
+  // Мы не можем запросить громкость с устройства, поэтому отслеживаем её локально
+  //  (если неизвестна и громкость модуля - шагаем им самим, как без объединения)
+  if(coalesce && moduleVolume != MP3_STATE_UNKNOWN)
+  {
+    // Накапливаем шаги, модулю уйдёт одна команда с итоговой громкостью
+    if(!volumeSteps++) volumeStepAt = millis();
+    volumeTarget = moduleVolume;
+    return;
+  }
+  
+  this->sendFixedCommand<MP3_CMD_VOL_UP>();
+  if(sentVolume != MP3_STATE_UNKNOWN && sentVolume < 30) sentVolume++;
 }
 
 void  AlashUartMP3::volumeDn()
 {
-  if(currentVolume > 0 ) currentVolume--;
-  // Конвертируем 0-100 в 0-30 для модуля
-  uint8_t moduleVolume = (currentVolume * 30) / 100;
-  this->sendCommand(MP3_CMD_VOL_DN); // Мы не можем запросить громкость с устройства, поэтому отслеживаем её локально
+  // Шаг - один из 30 шагов модуля, как у VOL_DN; громкость 0-100 пересчитывается из громкости модуля
+  //  с округлением вверх, чтобы обратный пересчёт (setVolume(), хранилище) дал ту же громкость модуля
+  uint8_t moduleVolume = this->volumeOnModule();
+  if(moduleVolume != MP3_STATE_UNKNOWN)
+  {
+    if(moduleVolume > 0)  moduleVolume--;
+    currentVolume = (moduleVolume * 100 + 29) / 30;
+  }
+  this->stateChanged();
+  
+  // Мы не можем запросить громкость с устройства, поэтому отслеживаем её локально
+  //  (если неизвестна и громкость модуля - шагаем им самим, как без объединения)
+  if(coalesce && moduleVolume != MP3_STATE_UNKNOWN)
+  {
+    // Накапливаем шаги, модулю уйдёт одна команда с итоговой громкостью
+    if(!volumeSteps++) volumeStepAt = millis();
+    volumeTarget = moduleVolume;
+    return;
+  }
+  
+  this->sendFixedCommand<MP3_CMD_VOL_DN>();
+  if(sentVolume != MP3_STATE_UNKNOWN && sentVolume > 0) sentVolume--;
+}
+
+uint8_t AlashUartMP3::volumeOnModule()
+{
+  if(volumeSteps)                     return volumeTarget;
+  if(sentVolume != MP3_STATE_UNKNOWN) return sentVolume;
+  return currentVolume != MP3_SETTING_UNKNOWN ? (currentVolume * 30) / 100 : MP3_STATE_UNKNOWN;
 }
 
 void  AlashUartMP3::setVolume(byte volumeFrom0To100)
@@ -213,38 +345,118 @@ void  AlashUartMP3::setVolume(byte volumeFrom0To100)
   // Ограничиваем диапазон 0-100
   if(volumeFrom0To100 > 100) volumeFrom0To100 = 100;
   currentVolume = volumeFrom0To100;
+  this->stateChanged();
+  
+  // Накопленные volumeUp()/volumeDn() больше не нужны
+  MP3_METRIC(metrics.framesCoalesced += volumeSteps);
+  framesSaved += volumeSteps;
+  volumeSteps = 0;
   
   // Конвертируем 0-100 в 0-30 для модуля
   uint8_t moduleVolume = (volumeFrom0To100 * 30) / 100;
+  if(coalesce && sentVolume == moduleVolume)
+  {
+    MP3_METRIC(metrics.framesSuppressed++);
+    framesSaved++;
+    return;
+  }
+  
   this->sendCommand(MP3_CMD_VOL_SET, moduleVolume);
+  sentVolume = moduleVolume;
 }
 
 void  AlashUartMP3::setEqualizer(byte equalizerMode)
 {
   currentEq = equalizerMode;
+  this->stateChanged();
+  if(coalesce && sentEq == equalizerMode)
+  {
+    MP3_METRIC(metrics.framesSuppressed++);
+    framesSaved++;
+    return;
+  }
+  
   this->sendCommand(MP3_CMD_EQ_SET, equalizerMode);
+  sentEq = equalizerMode;
 }
 
 void  AlashUartMP3::setLoopMode(byte loopMode)
 {
   currentLoop = loopMode;
+  this->stateChanged();
+  if(coalesce && sentLoop == loopMode)
+  {
+    MP3_METRIC(metrics.framesSuppressed++);
+    framesSaved++;
+    return;
+  }
+  
   this->sendCommand(MP3_CMD_LOOP_SET, loopMode);
+  sentLoop = loopMode;
+}
+
+void  AlashUartMP3::setCoalescing(bool enable, uint16_t deadlineMs)
+{
+  coalesceDeadline = deadlineMs;
+  if(!enable && volumeSteps)
+  {
+    this->flushVolume(true);
+    if(!asyncMode) this->flush();
+  }
+  coalesce = enable;
+}
+
+void  AlashUartMP3::flushVolume(bool wait)
+{
+  // Из poll() не ждём места в очереди - отправим в следующий раз
+  if(!wait && queueCount >= MP3_QUEUE_SIZE) return;
+  
+  uint16_t steps = volumeSteps;
+  volumeSteps = 0;
+  
+  // Из всех накопленных шагов уходит не больше одного кадра, а если громкость модуля не изменилась - ни одного
+  uint8_t moduleVolume = volumeTarget;
+  if(moduleVolume != sentVolume)
+  {
+    this->enqueue(MP3_CMD_VOL_SET, &moduleVolume, 1, NULL, false, true);
+    sentVolume = moduleVolume;
+    steps--;
+  }
+  MP3_METRIC(metrics.framesCoalesced += steps);
+  framesSaved += steps;
 }
 
 
 uint8_t AlashUartMP3::getAvailableSources() 
 {
-  return this->sendCommandWithByteResponse(MP3_CMD_GET_SOURCES);
+  uint8_t sources = this->sendCommandWithByteResponse(MP3_CMD_GET_SOURCES);
+  
+  // Носитель вставили или вынули - модуль мог сам переключить источник
+  if(knownSources != MP3_SRC_UNKNOWN && sources != knownSources)
+  {
+    knownSources = sources;
+    this->refreshSource();
+  }
+  knownSources = sources;
+  
+  return sources;
 }
 
 void  AlashUartMP3::setSource(byte source)
 {
+  currentSource = source;
+  this->stateChanged();
   this->sendCommand(MP3_CMD_SOURCE_SET, source);
 }
 
 uint8_t AlashUartMP3::getSource() 
 {
-  return this->sendCommandWithByteResponse(MP3_CMD_GET_SOURCE);
+  uint8_t source = 0;
+  
+  // Если модуль не ответил, не запоминаем ерунду - спросим в следующий раз
+  currentSource = this->sendCommand(MP3_CMD_GET_SOURCE, &source, 1) == MP3_RESULT_OK ? source : MP3_SRC_UNKNOWN;
+  
+  return source;
 }
 
 
@@ -258,69 +470,371 @@ void  AlashUartMP3::sleep()
   //  остановкой, и определил для удобства другую команду остановки
   //  как "СБРОС", мы отправим обе, чтобы быть уверенными
     
-  this->sendCommand(MP3_CMD_SLEEP);
-  this->sendCommand(MP3_CMD_STOP);
+  this->sendFixedCommand<MP3_CMD_SLEEP>();
+  this->sendFixedCommand<MP3_CMD_STOP>();
 }
 
 void  AlashUartMP3::reset()
 {
-  uint8_t retry = 5; // Максимальное количество попыток сброса, на случай если устройство зависло
-  do
+  // Несохранённые изменения настроек - сначала в хранилище, к ним и вернёмся
+  this->saveState();
+  
+  // Только что включённый модуль, пока загружается, теряет все команды - сначала ждём его
+  bool ready  = this->waitReady();
+  
+  // Модуль ответил только на последнюю проверку, а первые (не меньше двух подряд) потерял - значит,
+  //  он только что загрузился и уже в настройках по умолчанию. Одна потерянная или опоздавшая проверка
+  //  у работающего модуля выглядит так же, как загрузка между первой и второй, - тогда настройки отправляем
+  bool booted = ready && readyAnswers == 1 && readyProbes > 2;
+  
+  // В даташите определены две команды остановки, но нет команды сброса
+  //  Я решил сделать то, что выглядит больше как "универсальная остановка" 0x10
+  //  остановкой, и определил для удобства другую команду остановки
+  //  как "СБРОС", мы отправим обе, чтобы быть уверенными, а затем
+  //  вернем вещи к "значениям по умолчанию", в отсутствие фактического сброса
+  
+  //
+  //  Всё это уходит одной серией, паузы между кадрами выдерживает poll() (MP3_FRAME_GAP)
+  this->beginBatch();
+  this->sendFixedCommand<MP3_CMD_STOP>();
+  this->sendFixedCommand<MP3_CMD_RESET>();
+  
+  if(booted)
   {
-    // В даташите определены две команды остановки, но нет команды сброса
-    //  Я решил сделать то, что выглядит больше как "универсальная остановка" 0x10
-    //  остановкой, и определил для удобства другую команду остановки
-    //  как "СБРОС", мы отправим обе, чтобы быть уверенными, а затем
-    //  вернем вещи к "значениям по умолчанию", в отсутствие фактического сброса
-    
-    this->sendCommand(MP3_CMD_STOP);  delay(1); // Похоже, здесь что-то связано с таймингом
-    this->sendCommand(MP3_CMD_RESET); delay(1); //  связанное с таймингом
-    
-    
-    // Сброс к значениям по умолчанию при запуске
-    this->setVolume(67); // 67 в диапазоне 0-100 соответствует примерно 20 в старом диапазоне 0-30
-    this->setEqualizer(0);
-    this->setLoopMode(2);
-    this->seekFileByIndexNumber(1);
-    this->sendCommand(MP3_CMD_STOP);
+    sentVolume = (MP3_DEFAULT_VOLUME * 30) / 100;
+    sentEq     = MP3_DEFAULT_EQ;
+    sentLoop   = MP3_DEFAULT_LOOP;
+  }
+  else
+  {
+    // Что теперь выставлено в модуле - неизвестно, настройки нельзя пропускать
+    sentVolume = sentEq = sentLoop = MP3_STATE_UNKNOWN;
+  }
+  
+  // Сброс к значениям по умолчанию (или сохранённым в хранилище) при запуске
+  uint8_t volume, equalizer, loopMode;
+  this->startupSettings(volume, equalizer, loopMode);
+  this->applySettings(volume, equalizer, loopMode);
+  bool sourceSet = this->restoreSource();
+  this->seekFileByIndexNumber(1);
+  this->sendFixedCommand<MP3_CMD_STOP>();
+  this->endBatch();
+  
+  // После сброса модуль мог выбрать другой источник (без ответов модуля спрашивать бесполезно)
+  if(ready && !sourceSet)
+  {
+    this->refreshSource();
+  }
+}
+
+bool  AlashUartMP3::warmStart()
+{
+  // Модуль, который ещё загружается или не отвечает, - обычный сброс (он и дождётся загрузки)
+  if(!this->waitReady(MP3_READY_PROBE_INTERVAL * 2) || this->getStatus() != MP3_STATUS_STOPPED)
+  {
+    this->reset();
+    return false;
+  }
+  
+  // Модуль свои настройки сохранил, но какие они - неизвестно; если есть сохранённые - выставляем их одной серией
+  bool sourceSet = false;
+  if(!storeLoaded)
+  {
+    currentVolume = currentEq = currentLoop = MP3_SETTING_UNKNOWN;
+    sentVolume    = sentEq    = sentLoop    = MP3_STATE_UNKNOWN;
+  }
+  else
+  {
+    this->beginBatch();
+    sentVolume = sentEq = sentLoop = MP3_STATE_UNKNOWN;
     
-    uint8_t timeout = 9;
-    while(timeout-- > 0 )
+    uint8_t volume, equalizer, loopMode;
+    this->startupSettings(volume, equalizer, loopMode);
+    this->applySettings(volume, equalizer, loopMode);
+    sourceSet = this->restoreSource();
+    this->endBatch();
+  }
+  
+  if(!sourceSet)
+  {
+    this->refreshSource();
+  }
+  return true;
+}
+
+bool  AlashUartMP3::waitReady(uint16_t timeoutMs)
+{
+  this->flush();
+  
+  // Ответы на проверки перехватывает и считает dispatchFrame()
+  probing      = true;
+  readyProbes  = 0;
+  readyAnswers = 0;
+  
+  uint32_t start    = millis();
+  uint32_t probeAt  = start;
+  uint32_t lastSent = start;
+  uint16_t interval = MP3_READY_PROBE_INTERVAL;
+  while(!readyAnswers && millis() - start < timeoutMs)
+  {
+    if((int32_t)(millis() - probeAt) >= 0)
     {
-      if(getAvailableSources())
-      {
-        retry = 0;
-        break; 
-      }
-      delay(1);
+      this->sendFixedCommand<MP3_CMD_GET_SOURCES>();
+      if(readyProbes < 0xFF) readyProbes++;
+      lastSent  = millis();
+      probeAt  += interval;
+      interval  = interval * 2 > MP3_READY_PROBE_INTERVAL_MAX ? MP3_READY_PROBE_INTERVAL_MAX : interval * 2;
     }
+    this->waitStep();
+  }
+  
+  // Ответы на остальные проверки, если модуль их слышал, придут в пределах нижней границы ожидания
+  while(readyAnswers && readyAnswers < readyProbes && millis() - lastSent < firstByteMin)
+  {
+    this->waitStep();
+  }
+  
+  probing = false;
+  return readyAnswers > 0;
+}
+
+void  AlashUartMP3::applySettings(uint8_t volume, uint8_t equalizer, uint8_t loopMode)
+{
+  if(volume > 100) volume = 100;
+  currentVolume = volume;
+  currentEq     = equalizer;
+  currentLoop   = loopMode;
+  
+  MP3_METRIC(metrics.framesCoalesced += volumeSteps);
+  framesSaved += volumeSteps;
+  volumeSteps = 0;
+  
+  // Одинаковые с уже отправленными не отправляем
+  uint8_t moduleVolume = (volume * 30) / 100;
+  uint8_t suppressed   = 0;
+  if(moduleVolume != sentVolume)
+  {
+    this->sendCommand(MP3_CMD_VOL_SET, moduleVolume);
+    sentVolume = moduleVolume;
+  }
+  else suppressed++;
+  
+  if(equalizer != sentEq)
+  {
+    this->sendCommand(MP3_CMD_EQ_SET, equalizer);
+    sentEq = equalizer;
+  }
+  else suppressed++;
+  
+  if(loopMode != sentLoop)
+  {
+    this->sendCommand(MP3_CMD_LOOP_SET, loopMode);
+    sentLoop = loopMode;
+  }
+  else suppressed++;
+  
+  MP3_METRIC(metrics.framesSuppressed += suppressed);
+  framesSaved += suppressed;
+}
+
+
+void  AlashUartMP3::setStore(AlashUartMP3Store *store, uint16_t delayMs)
+{
+  this->store = store;
+  storeDelay  = delayMs;
+  storeDirty  = false;
+  storeLoaded = this->loadState();
+  
+  // Запомненные настройки - сохранённые, модулю их выставит reset()
+  if(storeLoaded)
+  {
+    currentVolume = storedState[0];
+    currentEq     = storedState[1];
+    currentLoop   = storedState[2];
+  }
+}
+
+bool  AlashUartMP3::loadState()
+{
+  uint8_t record[MP3_STORE_RECORD_SIZE];
+  if(!store || !store->load(record, sizeof(record))) return false;
+  
+  // Чистая EEPROM (0xFF), чужие данные и запись другого формата не подходят
+  uint8_t sum = 0;
+  for(uint8_t x = 0; x < MP3_STORE_RECORD_SIZE - 1; x++) sum += record[x];
+  if(record[0] != MP3_STORE_MAGIC || record[MP3_STORE_RECORD_SIZE - 1] != sum || record[1] > 100) return false;
+  
+  memcpy(storedState, record + 1, sizeof(storedState));
+  return true;
+}
+
+bool  AlashUartMP3::saveState()
+{
+  if(!store || !storeDirty) return false;
+  storeDirty = false;
+  
+  // Неизвестную настройку (warmStart() без хранилища) записывать нельзя - ждём, пока её установят
+  if(currentVolume == MP3_SETTING_UNKNOWN || currentEq == MP3_SETTING_UNKNOWN || currentLoop == MP3_SETTING_UNKNOWN) return false;
+  
+  // Настройки вернулись к уже записанным (громкость покрутили туда и обратно) - записывать нечего
+  uint8_t state[sizeof(storedState)] = { currentVolume, currentEq, currentLoop, currentSource };
+  if(storeLoaded && !memcmp(state, storedState, sizeof(state)))
+  {
+    MP3_METRIC(metrics.storeWritesSkipped++);
+    return false;
+  }
+  
+  uint8_t record[MP3_STORE_RECORD_SIZE];
+  uint8_t sum = record[0] = MP3_STORE_MAGIC;
+  for(uint8_t x = 0; x < sizeof(state); x++)
+  {
+    record[x + 1] = state[x];
+    sum += state[x];
+  }
+  record[MP3_STORE_RECORD_SIZE - 1] = sum;
+  
+  if(!store->save(record, sizeof(record)))
+  {
+    // Попробуем ещё раз через storeDelay
+    this->stateChanged();
+    return false;
   }
-  while(retry-- > 0);
+  
+  memcpy(storedState, state, sizeof(state));
+  storeLoaded = true;
+  MP3_METRIC(metrics.storeWrites++);
+  return true;
+}
+
+void  AlashUartMP3::startupSettings(uint8_t &volume, uint8_t &equalizer, uint8_t &loopMode)
+{
+  volume    = storeLoaded ? storedState[0] : MP3_DEFAULT_VOLUME;
+  equalizer = storeLoaded ? storedState[1] : MP3_DEFAULT_EQ;
+  loopMode  = storeLoaded ? storedState[2] : MP3_DEFAULT_LOOP;
 }
 
+bool  AlashUartMP3::restoreSource()
+{
+  // Только источник, который у модуля есть (носитель могли вынуть)
+  uint8_t source = storeLoaded ? storedState[3] : MP3_SRC_UNKNOWN;
+  if(source > 7 || knownSources == MP3_SRC_UNKNOWN || !(knownSources & (1 << source))) return false;
+  
+  currentSource = source;
+  this->sendCommand(MP3_CMD_SOURCE_SET, source);
+  return true;
+}
 
     byte  AlashUartMP3::getStatus()    
     {
-      if(MP3_STATUS_CHECKS_IN_AGREEMENT <= 1)
+      byte stat = this->sendCommandWithByteResponse(MP3_CMD_STATUS);
+      if(statusChecks <= 1)
       {
-        return this->sendCommandWithByteResponse(MP3_CMD_STATUS); 
+        lastStatus = stat;
+        return stat;
       }
       
-      byte statTotal = 0;
-      byte stat       = 0;
-      do
+      // Какой статус ожидается: итог последней команды, а если команд не было - прошлый подтверждённый статус
+      uint8_t predicted = expectedStatus != MP3_STATE_UNKNOWN ? expectedStatus
+                        : (statusTrust ? lastStatus : MP3_STATE_UNKNOWN);
+      
+      // Ответ согласуется с ожидаемым - переспрашивать незачем, ОСТАНОВКА довольно надежна
+      uint8_t queries    = 1;
+      bool    consistent = stat == MP3_STATUS_STOPPED || stat == predicted;
+      
+      // Иначе - переспрашиваем, пока неожиданный ответ не повторится (дважды, если ожидание
+      //  подтверждено не раз) или не придёт ожидаемый, но не больше statusChecks запросов
+      uint8_t agreeing = 1;
+      uint8_t needed   = predicted != MP3_STATE_UNKNOWN && statusTrust > 1 ? 3 : 2;
+      while(!consistent && queries < statusChecks)
       {
-        statTotal = 0;
-        for(byte x = 0; x < MP3_STATUS_CHECKS_IN_AGREEMENT; x++)
+        byte again = this->sendCommandWithByteResponse(MP3_CMD_STATUS);
+        queries++;
+        MP3_METRIC(metrics.statusRequeries++);
+        
+        if(again == MP3_STATUS_STOPPED || again == predicted)
         {
-          stat = this->sendCommandWithByteResponse(MP3_CMD_STATUS);      
-          if(stat == 0) return 0; // ОСТАНОВКА довольно надежна
-          statTotal += stat;
+          stat       = again;
+          consistent = true;
         }
-
-      } while (statTotal != 1 * MP3_STATUS_CHECKS_IN_AGREEMENT && statTotal != 2 * MP3_STATUS_CHECKS_IN_AGREEMENT);
+        else if(again == stat)
+        {
+          consistent = ++agreeing >= needed;
+        }
+        else
+        {
+          stat     = again;
+          agreeing = 1;
+        }
+      }
+      
+      // Неподтверждённый неожиданный ответ весит меньше, чем ожидание
+      if(!consistent && predicted != MP3_STATE_UNKNOWN)
+      {
+        stat = predicted;
+      }
+      
+      if(!consistent)
+      {
+        statusTrust = 0;
+      }
+      else if(stat == lastStatus)
+      {
+        if(statusTrust < MP3_STATUS_CONFIDENCE_MAX) statusTrust++;
+      }
+      else
+      {
+        statusTrust = 1;
+      }
+      
+      // Проверка N ответами подряд потратила бы statusChecks запросов на любой статус, кроме остановки
+      MP3_METRIC(if(stat != MP3_STATUS_STOPPED || queries > 1) metrics.statusQueriesSaved += statusChecks - queries);
+      
+      lastStatus     = stat;
+      expectedStatus = MP3_STATE_UNKNOWN;
+      return stat;
+    }
+    
+    void AlashUartMP3::expectStatus(uint8_t command)
+    {
+      switch(command)
+      {
+        case MP3_CMD_PLAY:
+        case MP3_CMD_NEXT:
+        case MP3_CMD_PREV:
+        case MP3_CMD_PLAY_IDX:
+        case MP3_CMD_NEXT_FOLDER:
+        case MP3_CMD_PREV_FOLDER:
+        case MP3_CMD_PLAY_FILE_FOLDER:
+        case MP3_CMD_PLAYLIST:
+        case MP3_CMD_AB_PLAY:
+          expectedStatus = MP3_STATUS_PLAYING;
+          break;
+          
+        case MP3_CMD_PAUSE:
+          expectedStatus = MP3_STATUS_PAUSED;
+          if(!pauseStartedAt) pauseStartedAt = millis() | 1;
+          return;
+          
+        case MP3_CMD_STOP:
+        case MP3_CMD_SLEEP:
+          expectedStatus = MP3_STATUS_STOPPED;
+          break;
+          
+        default:
+          return;
+      }
       
-      return statTotal / MP3_STATUS_CHECKS_IN_AGREEMENT;      
+      // Любая команда воспроизведения или остановки заканчивает паузу
+      if(pauseStartedAt)
+      {
+        pausedTotal   += millis() - pauseStartedAt;
+        pauseStartedAt = 0;
+      }
+    }
+    
+    uint32_t AlashUartMP3::pausedMillis()
+    {
+      return pausedTotal + (pauseStartedAt ? millis() - pauseStartedAt : 0);
     }
     
     byte  AlashUartMP3::getVolume()    { return currentVolume; }
@@ -338,19 +852,157 @@ void  AlashUartMP3::reset()
       return this->sendCommandWithUnsignedIntResponse(MP3_CMD_CURRENT_FILE_IDX); 
     }
     
+    uint16_t  AlashUartMP3::currentFolderFileCount()
+    {
+      return this->sendCommandWithUnsignedIntResponse(MP3_CMD_COUNT_IN_FOLDER);
+    }
+    
+    uint16_t  AlashUartMP3::currentFolderFirstIndex()
+    {
+      return this->sendCommandWithUnsignedIntResponse(MP3_CMD_FIRST_FILE_IN_FOLDER_IDX);
+    }
+    
     uint16_t  AlashUartMP3::currentFilePositionInSeconds() 
     {
+      // Модуль и так присылает позицию каждую секунду, берём последнюю
+      if(positionSubscription)
+      {
+        this->poll();
+        return lastPosition;
+      }
+      
       uint8_t buf[3];
       
       // Это включает непрерывную отчетность о позиции, каждую секунду
       this->sendCommandData(MP3_CMD_CURRENT_FILE_POS, 0, 0, buf, 3);
       
       // Останавливаем это
-      this->sendCommand(MP3_CMD_CURRENT_FILE_POS_STOP);
+      this->sendFixedCommand<MP3_CMD_CURRENT_FILE_POS_STOP>();
       
       return (buf[0]*60*60) + (buf[1]*60) + buf[2];
     }
     
+    uint8_t AlashUartMP3::snapshot(AlashUartMP3Snapshot &snapshot, uint8_t fields)
+    {
+      uint32_t start = micros();
+      
+      // Ответы на наши запросы должны приходить после всего, что уже стоит в очереди
+      this->flush();
+      
+      memset(&snapshot, 0, sizeof(snapshot));
+      
+      // Позиция уже известна из отчётов - не спрашиваем
+      if((fields & MP3_SNAPSHOT_POSITION) && positionSubscription && lastPositionAt)
+      {
+        snapshot.position = lastPosition;
+        snapshot.valid   |= MP3_SNAPSHOT_POSITION;
+      }
+      
+      snapshotTarget = &snapshot;
+      snapshotLastAt = millis();
+      
+      // Запросы уходят подряд, с минимальной паузой между кадрами, ответы разбирает dispatchFrame()
+      //  по мере прихода - в том числе пока ждём паузы перед следующим запросом
+      if(fields & MP3_SNAPSHOT_STATUS) this->sendFixedCommand<MP3_CMD_STATUS>();
+      if(fields & MP3_SNAPSHOT_INDEX)  this->sendFixedCommand<MP3_CMD_CURRENT_FILE_IDX>();
+      if(fields & MP3_SNAPSHOT_LENGTH) this->sendFixedCommand<MP3_CMD_CURRENT_FILE_LEN>();
+      if(fields & MP3_SNAPSHOT_NAME)   this->sendFixedCommand<MP3_CMD_CURRENT_FILE_NAME>();
+      // Запрос позиции включает отчёты каждую секунду - выключим их, когда придёт первый
+      bool positionAsked = fields & ~snapshot.valid & MP3_SNAPSHOT_POSITION;
+      if(positionAsked) this->sendFixedCommand<MP3_CMD_CURRENT_FILE_POS>();
+      
+      // Ждём, пока не придут все ответы, или пока модуль не замолчит дольше, чем ждали бы самого медленного из них
+      uint16_t silence = this->responseTimeout(MP3_CMD_STATUS);
+      if(this->responseTimeout(MP3_CMD_CURRENT_FILE_IDX)  > silence) silence = this->responseTimeout(MP3_CMD_CURRENT_FILE_IDX);
+      if(this->responseTimeout(MP3_CMD_CURRENT_FILE_LEN)  > silence) silence = this->responseTimeout(MP3_CMD_CURRENT_FILE_LEN);
+      if(this->responseTimeout(MP3_CMD_CURRENT_FILE_NAME) > silence) silence = this->responseTimeout(MP3_CMD_CURRENT_FILE_NAME);
+      if(this->responseTimeout(MP3_CMD_CURRENT_FILE_POS)  > silence) silence = this->responseTimeout(MP3_CMD_CURRENT_FILE_POS);
+      
+      uint32_t waitFrom = millis();
+      while((snapshot.valid & fields) != fields)
+      {
+        uint32_t last = (int32_t)(snapshotLastAt - waitFrom) > 0 ? snapshotLastAt : waitFrom;
+        if(millis() - last > silence) break;
+        this->waitStep();
+      }
+      
+      // Отчёт уже пришёл (или не придёт), следующий - только через секунду, его и отменяем.
+      //  Выключенный сразу за запросом, он мог ещё прислать отчёт после POS_STOP
+      if(positionAsked && !positionSubscription)
+      {
+        this->sendFixedCommand<MP3_CMD_CURRENT_FILE_POS_STOP>();
+      }
+      
+      snapshotTarget  = NULL;
+      snapshot.micros = micros() - start;
+      return snapshot.valid;
+    }
+    
+    bool AlashUartMP3::fillSnapshot()
+    {
+      AlashUartMP3Snapshot &s = *snapshotTarget;
+      uint8_t field;
+      
+      switch(rxCommand)
+      {
+        case MP3_CMD_STATUS:            field = MP3_SNAPSHOT_STATUS;   break;
+        case MP3_CMD_CURRENT_FILE_IDX:  field = MP3_SNAPSHOT_INDEX;    break;
+        case MP3_CMD_CURRENT_FILE_POS:  field = MP3_SNAPSHOT_POSITION; break;
+        case MP3_CMD_CURRENT_FILE_LEN:  field = MP3_SNAPSHOT_LENGTH;   break;
+        case MP3_CMD_CURRENT_FILE_NAME: field = MP3_SNAPSHOT_NAME;     break;
+        default: return false;
+      }
+      
+      // Повторный отчёт о позиции и т.п. - уже не наш ответ
+      if(s.valid & field) return false;
+      
+      switch(field)
+      {
+        case MP3_SNAPSHOT_STATUS:
+          if(rxCount < 1) return false;
+          s.status   = rxBuffer[0];
+          lastStatus = s.status;
+          break;
+          
+        case MP3_SNAPSHOT_INDEX:
+          if(rxCount < 2) return false;
+          s.index = ((uint16_t)rxBuffer[0] << 8) | rxBuffer[1];
+          break;
+          
+        case MP3_SNAPSHOT_POSITION:
+          if(rxCount < 3) return false;
+          s.position = lastPosition;
+          break;
+          
+        case MP3_SNAPSHOT_LENGTH:
+          if(rxCount < 3) return false;
+          s.length = (rxBuffer[0]*60*60) + (rxBuffer[1]*60) + rxBuffer[2];
+          break;
+          
+        case MP3_SNAPSHOT_NAME:
+          memcpy(s.name, rxBuffer, rxCount < sizeof(s.name) - 1 ? rxCount : sizeof(s.name) - 1);
+          break;
+      }
+      
+      s.valid       |= field;
+      snapshotLastAt = millis();
+      return true;
+    }
+    
+    void  AlashUartMP3::subscribePosition()
+    {
+      positionSubscription = true;
+      
+      // Первый отчёт придёт сразу же, дальше - каждую секунду, все они разбираются в poll()
+      this->sendFixedCommand<MP3_CMD_CURRENT_FILE_POS>();
+    }
+    
+    void  AlashUartMP3::unsubscribePosition()
+    {
+      positionSubscription = false;
+      this->sendFixedCommand<MP3_CMD_CURRENT_FILE_POS_STOP>();
+    }
+    
     uint16_t  AlashUartMP3::currentFileLengthInSeconds()   
     {
       uint8_t buf[3];
@@ -385,156 +1037,799 @@ void  AlashUartMP3::reset()
       return response;
     }
     
-    void  AlashUartMP3::sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength)
+    uint8_t AlashUartMP3::sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength)
     {
-      // Вычисляем контрольную сумму, включая все данные запроса
-      uint8_t MP3_CHECKSUM = MP3_CMD_BEGIN + command + requestLength;
+      bool expectResponse = responseBuffer && bufferLength;
       
-      for(uint8_t x = 0; x < requestLength; x++)
+      // В асинхронном режиме и внутри пакета команды без ответа только ставим в очередь,
+      //  если их данные помещаются в очередь целиком
+      if(!expectResponse && (asyncMode || batchHold) && requestLength <= MP3_QUEUE_PAYLOAD_SIZE)
       {
-        MP3_CHECKSUM += (uint8_t)requestBuffer[x];
-      }
+        // Пакет больше очереди: отправляем накопленное и набираем дальше
+        if(batchHold && !asyncMode && queueCount >= MP3_QUEUE_SIZE)
+        {
+          this->flush();
+          batchHold = true;
+        }
+        this->enqueue(command, requestBuffer, requestLength, NULL, false, true);
+        return MP3_RESULT_OK;
+      }
       
-#if MP3_DEBUG
-      Serial.println();
+      // Блокирующий вызов - это просто асинхронный запрос, который мы дожидаемся,
+      //  всё накопленное в пакете перед ним тоже придётся отправить, после него пакет набирается дальше
+      bool hold = batchHold;
+      batchHold = false;
+      AlashUartMP3Request request(0, 0, responseBuffer, bufferLength);
+      this->enqueue(command, requestBuffer, requestLength, &request, expectResponse, true);
+      while(request.pending())
+      {
+        this->waitStep();
+      }
+      batchHold = hold;
       
-      HEX_PRINT(MP3_CMD_BEGIN);  Serial.print(" ");
-      HEX_PRINT(command);        Serial.print(" ");
-      HEX_PRINT(requestLength);  Serial.print(" ");
+      return request.result;
+    }
+    
+    uint8_t AlashUartMP3::sendCommandGenerated(uint8_t command, uint16_t length, MP3PayloadSource source, void *context)
+    {
+      // Длина данных в кадре - один байт: лишнее не обрезаем, а не отправляем вовсе
+      if(length > 0xFF) return MP3_RESULT_TOO_LONG;
+      
+      // Источник данных вызывается только при отправке, поэтому ждём её здесь, как в блокирующем вызове,
+      //  после неё пакет набирается дальше
+      bool hold = batchHold;
+      batchHold = false;
+      AlashUartMP3Request request(0, 0, NULL, 0);
+      this->enqueue(command, NULL, 0, &request, false, true);
+      
+      QueueEntry &e = queue[(queueHead + queueCount - 1) % MP3_QUEUE_SIZE];
+      e.length            = length;
+      e.flags            |= MP3_ENTRY_GENERATED;
+      e.generator.source  = source;
+      e.generator.context = context;
       
-      for(uint8_t x = 0; x < requestLength; x++)
+      while(request.pending())
       {
-          HEX_PRINT(requestBuffer[x]); 
-          Serial.print(' ');
+        this->waitStep();
       }
+      batchHold = hold;
       
-      HEX_PRINT(MP3_CHECKSUM);  Serial.print(" ");
-#endif
+      return request.result;
+    }
+    
+    bool AlashUartMP3::queueRequest(uint8_t command, AlashUartMP3Request &request)
+    {
+      return this->enqueue(command, NULL, 0, &request, true, false);
+    }
+    
+    void AlashUartMP3::endBatch()
+    {
+      batchHold = false;
+      if(!asyncMode)
+      {
+        this->flush();
+      }
+    }
+    
+    void AlashUartMP3::flush()
+    {
+      batchHold = false;
+      if(volumeSteps)
+      {
+        this->flushVolume(true);
+      }
+      while(queueCount)
+      {
+        this->waitStep();
+      }
+    }
+    
+    bool AlashUartMP3::enqueue(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, AlashUartMP3Request *request, bool expectResponse, bool wait)
+    {
+      if(queueCount >= MP3_QUEUE_SIZE)
+      {
+        if(!wait) return false;
+        
+        while(queueCount >= MP3_QUEUE_SIZE)
+        {
+          this->waitStep();
+        }
+      }
       
-      // Если на линии есть случайный мусор, очищаем его сейчас.
-      while(this->waitUntilAvailable(10)) this->_Serial->read();
-
-      this->_Serial->write(MP3_CMD_BEGIN);
-      this->_Serial->write(command);
-      this->_Serial->write(requestLength);
-      for(uint8_t x = 0; x < requestLength; x++)
+      QueueEntry &e = queue[(queueHead + queueCount) % MP3_QUEUE_SIZE];
+      e.command = command;
+      e.length  = requestLength;
+      e.flags   = expectResponse ? MP3_ENTRY_RESPONSE : 0;
+      e.request = request;
+      
+      if(requestLength <= MP3_QUEUE_PAYLOAD_SIZE)
+      {
+        if(requestLength) memcpy(e.data, requestBuffer, requestLength);
+      }
+      else
       {
-          this->_Serial->write(requestBuffer[x]);
+        e.external = requestBuffer;
+        e.flags   |= MP3_ENTRY_EXTERNAL;
+      }
+      
+      if(request)
+      {
+        request->command = command;
+        request->length  = 0;
+        request->result  = MP3_RESULT_TIMEOUT;
+        request->state   = MP3_REQUEST_PENDING;
+        memset(request->data, 0, sizeof(request->data));
+        if(request->responseBuffer && request->bufferLength)
+        {
+          memset(request->responseBuffer, 0, request->bufferLength);
+        }
       }
-      this->_Serial->write(MP3_CHECKSUM);
+      
+      queueCount++;
+      return true;
+    }
+    
+    void AlashUartMP3::poll()
+    {
+      // Забираем всё, что уже пришло, не дожидаясь остального
+      this->receive();
+      
+      uint32_t now = millis();
+      
+      // Оборванный кадр не должен мешать разбору следующего,
+      //  а если это был ответ на текущий запрос - ждать больше нечего
+      uint32_t nowUs = micros();
+      if(rxState != MP3_RX_WAIT_BEGIN && nowUs - rxLastByteAt > interByteTimeoutMs * 1000UL)
+      {
+        bool response = rxState != MP3_RX_COMMAND && this->awaitingResponse(rxCommand);
+        rxState = MP3_RX_WAIT_BEGIN;
+        MP3_METRIC(metrics.resyncs++);
+        if(response)
+        {
+          this->completeHead(MP3_RESULT_TIMEOUT);
+        }
+      }
+      
+      // Накопленная громкость ждёт не дольше coalesceDeadline
+      if(volumeSteps && now - volumeStepAt >= coalesceDeadline)
+      {
+        this->flushVolume(false);
+      }
+      
+      // Настройки записываем, когда их перестали менять
+      if(storeDirty && now - storeChangedAt >= storeDelay)
+      {
+        this->saveState();
+      }
+      
+      while(queueCount)
+      {
+        QueueEntry &e = queue[queueHead];
+        
+        if(e.flags & MP3_ENTRY_SENT)
+        {
+          // Ждём начала ответа до txTimeout, если кадр уже принимается - его доведёт разбор выше
+          if(rxState == MP3_RX_WAIT_BEGIN && nowUs - txSentAt > txTimeout * 1000UL)
+          {
+            // Ответ ещё может прийти - тогда учтём его задержку; а пока ждём эту команду вдвое дольше
+            if(txLearn)
+            {
+              lateCommand = e.command;
+              lateSentAt  = txSentAt;
+              AlashUartMP3Latency *l = this->findLatency(e.command);
+              if(l && l->deviation < firstByteMax * 1000UL) l->deviation = l->deviation * 2 + 1000;
+            }
             
-      if(responseBuffer && bufferLength) 
+            this->completeHead(MP3_RESULT_TIMEOUT);
+            continue;
+          }
+          return;
+        }
+        
+        // Пакет ещё набирается - ждём endBatch() (или пока очередь не заполнится)
+        if(batchHold && queueCount < MP3_QUEUE_SIZE)
+        {
+          return;
+        }
+        
+        // Выдерживаем паузу между кадрами, пока предыдущий не ушёл с линии - следующий может идти вплотную
+        if(!this->frameGapElapsed())
+        {
+          return;
+        }
+        
+        this->transmit();
+        
+        if(!(e.flags & MP3_ENTRY_RESPONSE))
+        {
+          this->completeHead(MP3_RESULT_OK);
+          continue;
+        }
+        return;
+      }
+    }
+    
+    void AlashUartMP3::receive()
+    {
+      int n;
+      while((n = this->_Serial->available()) > 0)
+      {
+        rxBacklog = n - 1;
+        this->handleRxByte(this->_Serial->read());
+      }
+    }
+    
+    void AlashUartMP3::send(const uint8_t *buffer, uint8_t length)
+    {
+      this->_Serial->write(buffer, length);
+    }
+    
+    void AlashUartMP3::waitStep()
+    {
+      // Сначала ожидание, потом разбор: вызывающий сразу видит, дождался ли он своего.
+      //  Сроки остальных модулей группы здесь не видны - в группе спим не дольше времени одного байта
+      this->waitIdle(group ? byteTime : MP3_WAIT_MAX);
+      
+      this->poll();
+      if(group)
       {
-        memset(responseBuffer, 0, bufferLength);
+        group->pollExcept(this);
       }
+    }
+    
+    uint32_t AlashUartMP3::idleMicros(bool wakesOnInput)
+    {
+      if(this->_Serial->available() > 0) return 0;
+      
+      uint32_t now  = micros();
+      uint32_t wait = MP3_WAIT_MAX;
+      bool     sent = queueCount && (queue[queueHead].flags & MP3_ENTRY_SENT);
       
-      // Если мы не ожидаем ответа (или не заботимся), не ждем его
+      // Ближайший срок, к которому нужно что-то сделать без всякого прихода байтов
+      if(rxState != MP3_RX_WAIT_BEGIN)
+      {
+        wait = remaining(rxLastByteAt + interByteTimeoutMs * 1000UL, now);   // обрыв кадра
+      }
+      else if(sent)
+      {
+        wait = remaining(txSentAt + txTimeout * 1000UL, now);                // таймаут ответа
+      }
+      else if(queueCount && (!batchHold || queueCount >= MP3_QUEUE_SIZE))
+      {
+        wait = frameGap ? remaining(txWireEndAt + frameGap, now) : 0;        // пауза перед следующим кадром
+      }
+      
+      // Ожидание, которое приход байтов не прерывает, - пока кадр не должен прийти целиком: ответ начинается
+      //  через среднюю задержку команды, дальше байты идут подряд; пока длина неизвестна, рассчитываем
+      //  на самый короткий ответ AA CMD 01 DATA SUM
+      if(!wakesOnInput && (sent || rxState != MP3_RX_WAIT_BEGIN || !queueCount))
+      {
+        uint8_t  frameBytes = rxState >= MP3_RX_DATA ? rxLength + 4 : 5;
+        uint32_t expected   = 0;
+        AlashUartMP3Latency *l = sent ? this->findLatency(queue[queueHead].command) : NULL;
+        if(l)
+        {
+          expected = remaining(txSentAt + l->mean + (frameBytes - 1) * (uint32_t)byteTime, now);
+        }
+        else if(rxState != MP3_RX_WAIT_BEGIN)
+        {
+          // Последний байт пришёл не позже, чем был прочитан
+          uint8_t left = rxState == MP3_RX_DATA ? rxLength - rxCount + 1 : 1;
+          expected = remaining(rxLastByteAt + left * (uint32_t)byteTime, now);
+        }
+        
+        // Кадр уже должен был прийти - проверяем каждый байт
+        if(!expected) expected = byteTime;
+        if(expected < wait) wait = expected;
+      }
+      
+      return wait < MP3_WAIT_MAX ? wait : MP3_WAIT_MAX;
+    }
+    
+    void AlashUartMP3::waitIdle(uint32_t limitMicros)
+    {
+      if(!waitHandler && waitStrategy == MP3_WAIT_SPIN) return;
+      
+      uint32_t wait = this->idleMicros(waitHandler ? waitWakes : false);
+      if(wait > limitMicros) wait = limitMicros;
+      if(!wait) return;
+      
+#if MP3_METRICS
+      uint32_t start = micros();
+#endif
+      if(waitHandler)
+      {
+        waitHandler(wait, waitContext);
+      }
+      else if(waitStrategy == MP3_WAIT_SLEEP && wait >= 1000)
+      {
+        delay(wait / 1000);
+      }
       else
       {
-        return;
+        yield();
       }
+      MP3_METRIC(metrics.waitMicros += micros() - start);
+    }
+    
+    void AlashUartMP3::transmit()
+    {
+      QueueEntry &e = queue[queueHead];
+      const uint8_t *requestBuffer = (e.flags & MP3_ENTRY_EXTERNAL) ? e.external : e.data;
+      bool           generated     = e.flags & MP3_ENTRY_GENERATED;
       
-      // Даем время устройству обработать то, что мы сделали, и
-      // ответить, до 1 секунды, но обычно только несколько мс.
-      this->waitUntilAvailable(1000);
-
+      // Контрольная сумма считается по ходу отправки - данные могут выдаваться функцией по одному байту
+      uint8_t MP3_CHECKSUM = MP3_CMD_BEGIN + e.command + e.length;
+      
+#if MP3_DEBUG
+      Serial.println();
+      
+      HEX_PRINT(MP3_CMD_BEGIN);  Serial.print(" ");
+      HEX_PRINT(e.command);      Serial.print(" ");
+      HEX_PRINT(e.length);       Serial.print(" ");
+#endif
+      
+      uint8_t frame[MP3_TX_BUFFER_SIZE];
+      uint8_t n = 0;
+      
+      frame[n++] = MP3_CMD_BEGIN;
+      frame[n++] = e.command;
+      frame[n++] = e.length;
+      for(uint8_t x = 0; x < e.length; x++)
+      {
+        // Длинные данные отправляем частями, буфер ограничен
+        if(n == sizeof(frame))
+        {
+          this->send(frame, n);
+          n = 0;
+        }
+        uint8_t b = generated ? e.generator.source(x, e.generator.context) : requestBuffer[x];
+        MP3_CHECKSUM += b;
+        frame[n++]    = b;
+        
+#if MP3_DEBUG
+        HEX_PRINT(b);
+        Serial.print(' ');
+#endif
+      }
+      if(n == sizeof(frame))
+      {
+        this->send(frame, n);
+        n = 0;
+      }
+      frame[n++] = MP3_CHECKSUM;
+      this->send(frame, n);
+      
+#if MP3_DEBUG
+      HEX_PRINT(MP3_CHECKSUM);  Serial.print(" ");
+#endif
+      
+      e.flags |= MP3_ENTRY_SENT;
+      this->frameSent(e.command, e.length + 4);
+    }
+    
+    void AlashUartMP3::frameSent(uint8_t command, uint8_t frameLength)
+    {
+      MP3_METRIC(metrics.bytesTx += frameLength);
+      MP3_METRIC(if(command < MP3_METRICS_COMMANDS) metrics.commands[command]++);
+      
+      this->expectStatus(command);
+      txSentAt  = micros();
       
+      // Сразу за запуском по пути модуль может ещё искать файл: ответа ждём сколько разрешено,
+      //  а его задержку не учитываем - она не о команде
+      txLearn   = txCommand != MP3_CMD_PLAY_FILE_FOLDER;
+      txCommand = command;
+      txTimeout = txLearn ? this->responseTimeout(command) : firstByteMax;
+      
+      // Когда кадр закончится на линии (если порт буферизует передачу, он встанет в очередь за предыдущим)
+      uint32_t now = micros();
+      if((int32_t)(now - txWireEndAt) > 0) txWireEndAt = now;
+      txWireEndAt += (uint32_t)frameLength * byteTime;
+    }
+    
+    uint8_t AlashUartMP3::sendFixedFrame(const uint8_t *fixedFrame)
+    {
+      uint8_t frame[4];
+      memcpy_P(frame, fixedFrame, sizeof(frame));
+      
+      // Линия свободна - кадр уходит сразу, как есть
+      if(!queueCount && !batchHold && this->frameGapElapsed())
+      {
 #if MP3_DEBUG
-      Serial.print(" ==> [");
+        Serial.println();
+        for(uint8_t x = 0; x < sizeof(frame); x++)
+        {
+          HEX_PRINT(frame[x]); Serial.print(' ');
+        }
 #endif
+        this->send(frame, sizeof(frame));
+        this->frameSent(frame[1], sizeof(frame));
+        return MP3_RESULT_OK;
+      }
+      
+      // Иначе - через очередь, после уже поставленных команд
+      return this->sendCommandData(frame[1], NULL, 0, NULL, 0);
+    }
+    
+    void AlashUartMP3::completeHead(uint8_t result)
+    {
+      QueueEntry &e = queue[queueHead];
+      AlashUartMP3Request *request = e.request;
       
-      // Формат ответа такой же, как формат команды
-      //  AA [CMD] [DATA_COUNT] [B1..N] [SUM]
-      MP3_CHECKSUM = 0;
+      // Сначала убираем из очереди - функция обратного вызова может поставить новую команду
+      queueHead = (queueHead + 1) % MP3_QUEUE_SIZE;
+      queueCount--;
       
-      uint8_t      i = 0;
-      uint8_t      j = 0;
-      uint8_t      dataCount = 0;
-      while(this->waitUntilAvailable(150))
+#if MP3_METRICS
+      if(e.flags & MP3_ENTRY_RESPONSE)
       {
-        j = this->_Serial->read();
-                
+        if(result == MP3_RESULT_TIMEOUT)  metrics.timeouts++;
+        if(result == MP3_RESULT_CHECKSUM) metrics.checksumErrors++;
+        if(result == MP3_RESULT_OK && e.command < MP3_METRICS_COMMANDS)
+        {
+          static const uint8_t bounds[MP3_METRICS_BUCKETS - 1] = { 2, 5, 10, 20, 50, 100, 200 };
+          uint32_t latency = (micros() - txSentAt) / 1000;
+          uint8_t  bucket  = 0;
+          while(bucket < MP3_METRICS_BUCKETS - 1 && latency >= bounds[bucket]) bucket++;
+          metrics.latency[e.command][bucket]++;
+        }
+      }
+#endif
+      
 #if MP3_DEBUG
-        HEX_PRINT(j); Serial.print(" ");
+      if(e.flags & MP3_ENTRY_RESPONSE)
+      {
+        Serial.print(" ==> ");
+        if(result == MP3_RESULT_OK)       Serial.print("OK");
+        if(result == MP3_RESULT_CHECKSUM) Serial.print("** КОНТРОЛЬНАЯ СУММА НЕ ПРОШЛА");
+        if(result == MP3_RESULT_TIMEOUT)  Serial.print("** НЕТ ОТВЕТА");
+        Serial.println();
+      }
 #endif
-        if(i == 2)
+      
+      if(request)
+      {
+        request->result = result;
+        request->state  = MP3_REQUEST_DONE;
+        if(request->callback)
         {
-          // Количество байтов данных для чтения
-          dataCount = j;
+          request->callback(*request);
         }
+      }
+    }
+    
+    void AlashUartMP3::handleRxByte(uint8_t b)
+    {
+      // Когда начался кадр и самая длинная пауза внутри него - для таймаутов.
+      //  Байт, дождавшийся чтения в буфере порта (например, во время сна, см. setWaitStrategy()), пришёл раньше -
+      //  на время передачи байтов за ним, но не раньше предыдущего байта и отправки команды
+      uint32_t now = micros() - rxBacklog * (uint32_t)byteTime;
+      rxBacklog = 0;
+      if((int32_t)(now - rxLastByteAt) < 0) now = rxLastByteAt;
+      if((int32_t)(now - txSentAt) < 0)     now = txSentAt;
+      if(rxState == MP3_RX_WAIT_BEGIN)
+      {
+        rxFrameAt = now;
+        rxMaxGap  = 0;
+      }
+      else if(now - rxLastByteAt > rxMaxGap)
+      {
+        rxMaxGap = now - rxLastByteAt;
+      }
+      rxLastByteAt = now;
+      MP3_METRIC(metrics.bytesRx++);
+      
+#if MP3_DEBUG
+      HEX_PRINT(b); Serial.print(" ");
+#endif
+      
+      this->feedByte(b);
+    }
+    
+    void AlashUartMP3::feedByte(uint8_t b)
+    {
+      uint8_t frame = this->parseFrameByte(b);
+      if(frame == MP3_FRAME_INCOMPLETE) return;
+      
+      if(frame == MP3_FRAME_OK)
+      {
+        this->dispatchFrame();
+        return;
+      }
+      
+      // Кадр не сложился: возможно, 0xAA был случайным байтом мусора, а настоящий
+      //  кадр начинается где-то внутри принятого - разбираем эти байты заново
+      MP3_METRIC(metrics.resyncs++);
+      uint8_t command = rxCommand;
+      uint8_t bytes[MP3_RX_BUFFER_SIZE + 3];
+      uint8_t n = 0;
+      
+      bytes[n++] = rxCommand;
+      bytes[n++] = rxLength;
+      if(frame == MP3_FRAME_BAD)
+      {
+        memcpy(&bytes[n], rxBuffer, rxCount);
+        n += rxCount;
+        bytes[n++] = b;
+      }
+      
+      // Не сложился и кадр внутри них - разбор возвращается к байту после его 0xAA, в том же буфере
+      //  (без рекурсии: каждый возврат начинает дальше предыдущего, так что разбор конечен)
+      uint8_t begin = 0;
+      for(uint8_t x = 0; x < n; x++)
+      {
+        if(rxState == MP3_RX_WAIT_BEGIN) begin = x;
         
-        // Мы записываем только байты данных, поэтому байты 0,1 и 2 отбрасываются
-        //   за исключением вычисления контрольной суммы
-        if(i <= 2) 
+        uint8_t inner = this->parseFrameByte(bytes[x]);
+        if(inner == MP3_FRAME_OK)
         {
-          MP3_CHECKSUM += j;
-          i++;
-          continue;
+          this->dispatchFrame();
         }
-        else
+        else if(inner != MP3_FRAME_INCOMPLETE)
+        {
+          MP3_METRIC(metrics.resyncs++);
+          x = begin;
+        }
+      }
+      
+      // Другого кадра там не нашлось - значит, это был испорченный ответ на наш запрос
+      if(frame == MP3_FRAME_BAD && rxState == MP3_RX_WAIT_BEGIN && this->awaitingResponse(command))
+      {
+        this->completeHead(MP3_RESULT_CHECKSUM);
+      }
+    }
+    
+    void AlashUartMP3::dispatchFrame()
+    {
+      this->learnGap(rxMaxGap);
+      
+      // Любой отчёт о позиции запоминаем, будь то ответ или сам по себе
+      if(rxCommand == MP3_CMD_CURRENT_FILE_POS && rxCount >= 3)
+      {
+        lastPosition   = (rxBuffer[0]*60*60) + (rxBuffer[1]*60) + rxBuffer[2];
+        lastPositionAt = millis();
+      }
+      
+      // Ответ на проверку готовности (waitReady()) - проверки отправляются мимо очереди
+      if(probing && rxCommand == MP3_CMD_GET_SOURCES && rxCount >= 1)
+      {
+        knownSources = rxBuffer[0];
+        if(readyAnswers < 0xFF) readyAnswers++;
+        return;
+      }
+      
+      // Ответы на запросы снимка состояния (snapshot()) приходят подряд, без очереди
+      if(snapshotTarget && this->fillSnapshot())
+      {
+        return;
+      }
+      
+      // Ответ на текущий запрос имеет тот же байт команды, что и запрос
+      if(this->awaitingResponse(rxCommand))
+      {
+        if(txLearn) this->learnLatency(rxCommand, rxFrameAt - txSentAt);
+        
+        AlashUartMP3Request *request = queue[queueHead].request;
+        if(request)
         {
-          if(dataCount > 0)
+          uint8_t n = rxCount;
+          if(request->responseBuffer)
           {
-            // Это байт данных для чтения
-            if((i-3) <= (bufferLength-1))
-            {
-              responseBuffer[i-3] = j;
-            }
-            i++;
-            dataCount--;
-            MP3_CHECKSUM += j;
+            memcpy(request->responseBuffer, rxBuffer, n < request->bufferLength ? n : request->bufferLength);
           }
           else
           {
-            // Это байт контрольной суммы
-            if((MP3_CHECKSUM & 0xFF) != j)
-            {
-              // Контрольная сумма не прошла
-              #if MP3_DEBUG
-                Serial.print(" ** КОНТРОЛЬНАЯ СУММА НЕ ПРОШЛА " );
-                HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-                Serial.print(" != ");
-                HEX_PRINT(j); 
-              #endif
-              memset(responseBuffer, 0, bufferLength);
-            }
-            else
-            {
-               #if MP3_DEBUG
-                Serial.print(" ** КОНТРОЛЬНАЯ СУММА ОК " );
-                HEX_PRINT((MP3_CHECKSUM & 0xFF)); 
-                Serial.print(" == ");
-                HEX_PRINT(j); 
-              #endif
-            }
+            memcpy(request->data, rxBuffer, n < sizeof(request->data) ? n : sizeof(request->data));
           }
+          request->length = rxCount;
         }
+        
+        this->completeHead(MP3_RESULT_OK);
+        return;
       }
       
-#if MP3_DEBUG      
-      Serial.print("] --> ");
-      for(uint8_t x = 0; x < bufferLength; x++)
+      // Опоздавший ответ: таймаут был слишком коротким, учитываем его задержку
+      if(lateCommand && rxCommand == lateCommand && rxCommand != MP3_CMD_CURRENT_FILE_POS)
       {
-        HEX_PRINT(responseBuffer[x]);
+        this->learnLatency(lateCommand, rxFrameAt - lateSentAt);
+        lateCommand = 0;
+        MP3_METRIC(metrics.lateResponses++);
       }
       
-      Serial.println();
-#endif
+      // Всё остальное модуль прислал сам
+      if(rxCommand == MP3_CMD_CURRENT_FILE_POS && rxCount >= 3)
+      {
+        MP3_METRIC(metrics.unsolicited++);
+        if(positionHandler)
+        {
+          positionHandler(lastPosition, positionContext);
+        }
+        return;
+      }
+      
+      MP3_METRIC(metrics.unsolicited++);
       
+      if(unsolicitedHandler)
+      {
+        unsolicitedHandler(rxCommand, rxBuffer, rxCount, unsolicitedContext);
+      }
+    }
+    
+    void AlashUartMP3::setTimeoutLimits(uint16_t firstByteMinMs, uint16_t firstByteMaxMs, uint16_t interByteMinMs, uint16_t interByteMaxMs)
+    {
+      firstByteMin = firstByteMinMs;
+      firstByteMax = firstByteMaxMs < firstByteMinMs ? firstByteMinMs : firstByteMaxMs;
+      interByteMin = interByteMinMs;
+      interByteMax = interByteMaxMs < interByteMinMs ? interByteMinMs : interByteMaxMs;
+      interByteTimeoutMs = gapMeasured ? deadline(gapMean, gapDeviation, interByteMin, interByteMax) : interByteMax;
+    }
+    
+    uint16_t AlashUartMP3::responseTimeout(uint8_t command)
+    {
+      // Пока задержка не измерена - ждём сколько разрешено
+      AlashUartMP3Latency *l = this->findLatency(command);
+      return l ? deadline(l->mean, l->deviation, firstByteMin, firstByteMax) : firstByteMax;
+    }
+    
+    AlashUartMP3Latency *AlashUartMP3::findLatency(uint8_t command)
+    {
+      for(uint8_t x = 0; x < MP3_LATENCY_SLOTS; x++)
+      {
+        if(latencies[x].samples && latencies[x].command == command) return &latencies[x];
+      }
+      return NULL;
+    }
+    
+    void AlashUartMP3::learnLatency(uint8_t command, uint32_t micros)
+    {
+      AlashUartMP3Latency *l = this->findLatency(command);
+      if(!l)
+      {
+        // Новая команда занимает записи по кругу
+        l = &latencies[latencyNext];
+        if(++latencyNext >= MP3_LATENCY_SLOTS) latencyNext = 0;
+        l->command = command;
+        l->samples = 0;
+      }
+      
+      smooth(l->mean, l->deviation, micros, !l->samples);
+      if(l->samples < 0xFF) l->samples++;
+    }
+    
+    void AlashUartMP3::learnGap(uint32_t micros)
+    {
+      smooth(gapMean, gapDeviation, micros, !gapMeasured);
+      gapMeasured = true;
+      interByteTimeoutMs = deadline(gapMean, gapDeviation, interByteMin, interByteMax);
+    }
+    
+    void AlashUartMP3::smooth(uint32_t &mean, uint32_t &deviation, uint32_t sample, bool first)
+    {
+      if(first)
+      {
+        mean      = sample;
+        deviation = sample / 2;
+        return;
+      }
+      
+      // mean += (sample - mean) / 8, deviation += (|sample - mean| - deviation) / 4
+      int32_t error = (int32_t)(sample - mean);
+      mean += error / 8;
+      uint32_t distance = error < 0 ? -error : error;
+      deviation = deviation - deviation / 4 + distance / 4;
+    }
+    
+    uint16_t AlashUartMP3::deadline(uint32_t mean, uint32_t deviation, uint16_t minMs, uint16_t maxMs)
+    {
+      uint32_t ms = (mean + MP3_TIMEOUT_DEVIATIONS * deviation) / 1000 + 1;
+      return ms < minMs ? minMs : (ms > maxMs ? maxMs : ms);
+    }
+    
+    uint8_t AlashUartMP3::parseFrameByte(uint8_t b)
+    {
+      switch(rxState)
+      {
+        case MP3_RX_WAIT_BEGIN:
+          // Всё, что до байта начала кадра - мусор, пропускаем
+          if(b == MP3_CMD_BEGIN)
+          {
+            rxChecksum = b;
+            rxState    = MP3_RX_COMMAND;
+          }
+          return MP3_FRAME_INCOMPLETE;
+          
+        case MP3_RX_COMMAND:
+          rxCommand   = b;
+          rxChecksum += b;
+          rxState     = MP3_RX_LENGTH;
+          return MP3_FRAME_INCOMPLETE;
+          
+        case MP3_RX_LENGTH:
+          rxLength    = b;
+          rxCount     = 0;
+          if(rxLength > MP3_RX_BUFFER_SIZE)
+          {
+            // Модуль не присылает таких длинных ответов - это мусор
+            rxState = MP3_RX_WAIT_BEGIN;
+            return MP3_FRAME_BAD_LENGTH;
+          }
+          rxChecksum += b;
+          rxState     = rxLength ? MP3_RX_DATA : MP3_RX_CHECKSUM;
+          return MP3_FRAME_INCOMPLETE;
+          
+        case MP3_RX_DATA:
+          rxBuffer[rxCount++] = b;
+          rxChecksum += b;
+          if(rxCount == rxLength) rxState = MP3_RX_CHECKSUM;
+          return MP3_FRAME_INCOMPLETE;
+          
+        default:
+          // Это байт контрольной суммы, кадр закончен
+          rxState = MP3_RX_WAIT_BEGIN;
+          if(rxChecksum != b)
+          {
+            return MP3_FRAME_BAD;
+          }
+          return MP3_FRAME_OK;
+      }
     }
     
 
-// Блокирующее ожидание с таймаутом для последовательного ввода
-int AlashUartMP3::waitUntilAvailable(uint16_t maxWaitTime)
+#if MP3_METRICS
+void AlashUartMP3::dumpMetrics(Print &out)
 {
-  uint32_t startTime;
-  int c = 0;
-  startTime = millis();
-  do {
-    c = this->_Serial->available();
-    if (c) break;
-  } while(millis() - startTime < maxWaitTime);
+  out.println(F("metric,value"));
+  out.print(F("bytes_tx,"));           out.println(metrics.bytesTx);
+  out.print(F("bytes_rx,"));           out.println(metrics.bytesRx);
+  out.print(F("timeouts,"));           out.println(metrics.timeouts);
+  out.print(F("checksum_errors,"));    out.println(metrics.checksumErrors);
+  out.print(F("resyncs,"));            out.println(metrics.resyncs);
+  out.print(F("unsolicited,"));        out.println(metrics.unsolicited);
+  out.print(F("frames_coalesced,"));   out.println(metrics.framesCoalesced);
+  out.print(F("frames_suppressed,"));  out.println(metrics.framesSuppressed);
+  out.print(F("status_requeries,"));   out.println(metrics.statusRequeries);
+  out.print(F("status_saved,"));       out.println(metrics.statusQueriesSaved);
+  out.print(F("store_writes,"));       out.println(metrics.storeWrites);
+  out.print(F("store_skipped,"));      out.println(metrics.storeWritesSkipped);
+  out.print(F("late_responses,"));     out.println(metrics.lateResponses);
+  out.print(F("wait_us,"));            out.println(metrics.waitMicros);
+  out.print(F("interbyte_timeout_ms,")); out.println(interByteTimeoutMs);
+  
+  out.println(F("latency,samples,mean_us,deviation_us,timeout_ms"));
+  for(uint8_t n = 0; n < MP3_LATENCY_SLOTS; n++)
+  {
+    if(!latencies[n].samples) continue;
+    
+    out.print(F("0x"));
+    if(latencies[n].command < 16) out.print('0');
+    out.print(latencies[n].command, HEX);
+    out.print(',');
+    out.print(latencies[n].samples);
+    out.print(',');
+    out.print(latencies[n].mean);
+    out.print(',');
+    out.print(latencies[n].deviation);
+    out.print(',');
+    out.println(this->responseTimeout(latencies[n].command));
+  }
   
-  return c;
+  out.println(F("command,count,lt2ms,lt5ms,lt10ms,lt20ms,lt50ms,lt100ms,lt200ms,ge200ms"));
+  for(uint8_t c = 0; c < MP3_METRICS_COMMANDS; c++)
+  {
+    if(!metrics.commands[c]) continue;
+    
+    out.print(F("0x"));
+    if(c < 16) out.print('0');
+    out.print(c, HEX);
+    out.print(',');
+    out.print(metrics.commands[c]);
+    for(uint8_t b = 0; b < MP3_METRICS_BUCKETS; b++)
+    {
+      out.print(',');
+      out.print(metrics.latency[c][b]);
+    }
+    out.println();
+  }
 }
-
+#endif
@@ -44,20 +44,298 @@
 
 #define MP3_LOOP_NONE            2
 
+// Громкость, эквалайзер или режим цикла неизвестны (getVolume() и т.п. после warmStart() без хранилища):
+//  модуль их не сообщает, а после перезагрузки контроллера они остались какими были
+#define MP3_SETTING_UNKNOWN    0xFF
+
 #define MP3_STATUS_STOPPED 0
 #define MP3_STATUS_PLAYING 1
 #define MP3_STATUS_PAUSED  2
 
 // Ответ от запроса статуса может быть ненадежным
 //  мы можем увеличить это, чтобы проверить несколько раз.
-#define MP3_STATUS_CHECKS_IN_AGREEMENT 1
+//  Это значение по умолчанию для setStatusChecks(): сколько запросов можно сделать
+//  за один getStatus(), если ответ расходится с тем, что ожидалось.
+#ifndef MP3_STATUS_CHECKS_IN_AGREEMENT
+  #define MP3_STATUS_CHECKS_IN_AGREEMENT 1
+#endif
+
+// Максимальная уверенность в статусе: сколько подряд согласованных ответов помнится
+#define MP3_STATUS_CONFIDENCE_MAX 3
 
 #define MP3_DEBUG 0
 
+// Сбор статистики обмена (счётчики команд, ошибок, гистограмма задержек), см. getMetrics().
+//  Занимает около 800 байтов ОЗУ, поэтому на AVR по умолчанию выключен.
+#ifndef MP3_METRICS
+  #if defined(__AVR__)
+    #define MP3_METRICS 0
+  #else
+    #define MP3_METRICS 1
+  #endif
+#endif
+
+// Учёт статистики в коде библиотеки, при выключенной статистике не оставляет ничего
+#if MP3_METRICS
+  #define MP3_METRIC(x) x
+#else
+  #define MP3_METRIC(x)
+#endif
+
+// Статистика ведётся для команд с байтом от 0 до MP3_METRICS_COMMANDS-1 (вся таблица команд)
+#define MP3_METRICS_COMMANDS 0x27
+
+// Количество интервалов гистограммы задержки ответа: <2, <5, <10, <20, <50, <100, <200 и от 200 мс
+#define MP3_METRICS_BUCKETS  8
+
+// Результат приёма ответа от модуля (возвращается sendCommandData)
+#define MP3_RESULT_OK        0 ///< Кадр ответа принят, контрольная сумма сошлась
+#define MP3_RESULT_CHECKSUM  1 ///< Кадр принят целиком, но контрольная сумма не сошлась
+#define MP3_RESULT_TIMEOUT   2 ///< Ответ не пришёл (или оборвался) за отведённое время
+#define MP3_RESULT_TOO_LONG  3 ///< Данные не помещаются в один кадр (больше 255 байтов), ничего не отправлено
+
+// Сколько файлов помещается в один список playSequence...(): по два байта имени на файл в кадре до 255 байтов
+#define MP3_SEQUENCE_MAX   127
+
+// Таймауты приёма ответа, мс - пределы, в которых они подстраиваются под измеренные задержки модуля
+//  (см. setTimeoutLimits()), пока задержки не измерены - действует верхний предел
+//   FIRST_BYTE - ожидание начала ответа после отправки команды
+//   INTERBYTE  - максимальная пауза между байтами внутри одного кадра
+#define MP3_TIMEOUT_FIRST_BYTE     1000
+#define MP3_TIMEOUT_FIRST_BYTE_MIN   50
+#define MP3_TIMEOUT_INTERBYTE       150
+#define MP3_TIMEOUT_INTERBYTE_MIN    20
+
+// Таймаут - средняя задержка плюс столько средних отклонений от неё
+#define MP3_TIMEOUT_DEVIATIONS 4
+
+// Для скольких команд с ответом запоминается задержка модуля
+#ifndef MP3_LATENCY_SLOTS
+  #if defined(__AVR__)
+    #define MP3_LATENCY_SLOTS 4
+  #else
+    #define MP3_LATENCY_SLOTS 8
+  #endif
+#endif
+
+// Ожидание готовности модуля (waitReady(), reset(), warmStart()), мс:
+//   READY_TIMEOUT            - сколько всего ждать, пока модуль (например, только что включённый) начнёт отвечать
+//   READY_PROBE_INTERVAL     - пауза после первой проверки, больше времени ответа на 9600 бод (около 12 мс);
+//                              дальше она удваивается до READY_PROBE_INTERVAL_MAX - загружающийся модуль
+//                              проверки теряет, и чем их меньше, тем меньше лишнего на линии
+#define MP3_READY_TIMEOUT            2000
+#define MP3_READY_PROBE_INTERVAL     25
+#define MP3_READY_PROBE_INTERVAL_MAX 100
+
+// Настройки, которые выставляет reset(), - они же настройки модуля после включения питания
+#define MP3_DEFAULT_VOLUME 67            // 0-100, примерно 20 в диапазоне модуля 0-30
+#define MP3_DEFAULT_EQ     MP3_EQ_NORMAL
+#define MP3_DEFAULT_LOOP   MP3_LOOP_NONE
+
+// Через сколько миллисекунд после последнего изменения настроек записать их в хранилище (setStore()):
+//  поворот регулятора громкости - одна запись, а не десятки
+#define MP3_STORE_DELAY 3000
+
+// Как ждут блокирующие вызовы, пока модуль передаёт или готовит ответ (setWaitStrategy())
+#define MP3_WAIT_SPIN  0 // Непрерывно опрашивать порт: наименьшая задержка, но ядро процессора занято всё время
+#define MP3_WAIT_YIELD 1 // Опрашивать порт, вызывая yield() между опросами (фоновые задачи ESP8266, задачи того же приоритета на ESP32)
+#define MP3_WAIT_SLEEP 2 // Засыпать через delay() до ожидаемого прихода ответа или ближайшего срока: ядро свободно для других задач
+
+// Дольше скольких микросекунд не ждать за один шаг без опроса порта: сроки, о которых ожидание не знает
+//  (объединение громкости, запись настроек), сдвигаются не больше чем на это время
+#define MP3_WAIT_MAX 5000
+
+// Максимальное количество байтов данных в ответе модуля (самый длинный - имя файла 8.3),
+//  кадр с большей длиной считается мусором.
+#define MP3_RX_BUFFER_SIZE 16
+
+// Размер очереди команд асинхронного движка (количество кадров)
+#ifndef MP3_QUEUE_SIZE
+  #if defined(__AVR__)
+    #define MP3_QUEUE_SIZE 4
+  #else
+    #define MP3_QUEUE_SIZE 8
+  #endif
+#endif
+
+// Сколько байтов данных команды хранится прямо в очереди,
+//  самая длинная встроенная команда - путь файла в папке (13 байтов)
+#define MP3_QUEUE_PAYLOAD_SIZE 13
+
+// Буфер сборки кадра для отправки одним вызовом write(): заголовок (3 байта) + данные + контрольная сумма,
+//  кадры с более длинными данными (плейлисты) отправляются частями такого размера
+#define MP3_TX_BUFFER_SIZE (MP3_QUEUE_PAYLOAD_SIZE + 4)
+
+// Минимальная пауза на линии между концом одного кадра команды и началом следующего, мкс
+//  (раньше здесь стоял delay(1) в reset(), "похоже, здесь что-то связано с таймингом")
+#define MP3_FRAME_GAP 1000
+
+// Через сколько миллисекунд после первого из накопленных volumeUp()/volumeDn() отправить итоговую громкость,
+//  см. setCoalescing()
+#define MP3_COALESCE_DEADLINE 50
+
+// Скорость порта модуля по умолчанию, нужна для расчёта, когда кадр закончится на линии
+#define MP3_BAUD_RATE 9600
+
+// Состояние асинхронного запроса
+#define MP3_REQUEST_IDLE    0 ///< Запрос ещё не ставился в очередь
+#define MP3_REQUEST_PENDING 1 ///< Запрос в очереди или ожидает ответа
+#define MP3_REQUEST_DONE    2 ///< Запрос завершён, результат в result
+
 #define HEX_PRINT(a) if(a < 16) Serial.print(0); Serial.print(a, HEX);
 
+class AlashUartMP3Request;
+
+/** Функция, вызываемая из `poll()` по завершении асинхронного запроса. */
+typedef void (*MP3RequestCallback)(AlashUartMP3Request &request);
+
+/** Функция, вызываемая из `poll()` для кадра, который модуль прислал сам (не в ответ на запрос). */
+typedef void (*MP3FrameHandler)(uint8_t command, const uint8_t *data, uint8_t length, void *context);
+
+/** Функция, вызываемая из `poll()` при получении отчёта о позиции воспроизведения. */
+typedef void (*MP3PositionHandler)(uint16_t seconds, void *context);
+
+/** Источник списка для `playSequence()`: номер файла (0-99) в папке "ZH" для элемента position (от 0). */
+typedef uint8_t (*MP3SequenceSource)(uint8_t position, void *context);
+
+/** Источник данных кадра: байт данных со смещением offset, вызывается по разу на байт во время отправки. */
+typedef uint8_t (*MP3PayloadSource)(uint8_t offset, void *context);
+
+/** Функция ожидания для блокирующих вызовов (см. `setWaitHandler()`): может вернуться раньше, но не позже maxMicros. */
+typedef void (*MP3WaitHandler)(uint32_t maxMicros, void *context);
+
+/** Асинхронный запрос к модулю.
+ *
+ *  Объект принадлежит вызывающему коду и должен существовать, пока запрос не завершится.
+ *  Завершение можно узнать, проверяя `done()`, или через функцию обратного вызова.
+ *
+ *      AlashUartMP3Request statusRequest;
+ *
+ *      void loop()
+ *      {
+ *        mp3.poll();
+ *        if(!statusRequest.pending())
+ *        {
+ *          if(statusRequest.done() && statusRequest.result == MP3_RESULT_OK)
+ *          {
+ *            Serial.println(statusRequest.asByte());
+ *          }
+ *          mp3.requestStatus(statusRequest);
+ *        }
+ *        // ... остальная работа не блокируется
+ *      }
+ */
+
+class AlashUartMP3Request
+{
+  public:
+    AlashUartMP3Request(MP3RequestCallback callback = 0, void *context = 0, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
+      : callback(callback), context(context), responseBuffer(responseBuffer), bufferLength(bufferLength) { }
+
+    MP3RequestCallback callback;       ///< Вызывается по завершении (может быть NULL)
+    void              *context;        ///< Произвольные данные для функции обратного вызова
+    uint8_t           *responseBuffer; ///< Внешний буфер для длинного ответа (например, имени файла), если NULL - используется data
+    uint8_t            bufferLength;   ///< Длина внешнего буфера
+
+    uint8_t state   = MP3_REQUEST_IDLE;   ///< MP3_REQUEST_IDLE, MP3_REQUEST_PENDING или MP3_REQUEST_DONE
+    uint8_t result  = MP3_RESULT_TIMEOUT; ///< MP3_RESULT_OK, MP3_RESULT_CHECKSUM или MP3_RESULT_TIMEOUT
+    uint8_t command = 0;                  ///< Байт команды запроса
+    uint8_t length  = 0;                  ///< Количество байтов данных в ответе
+    uint8_t data[4] = { 0, 0, 0, 0 };     ///< Данные короткого ответа (если responseBuffer не задан)
+
+    bool pending() const { return state == MP3_REQUEST_PENDING; }
+    bool done()    const { return state == MP3_REQUEST_DONE;    }
+
+    /** Данные ответа (внешний буфер, если задан, иначе data). */
+    const uint8_t *bytes() const { return responseBuffer ? responseBuffer : data; }
+
+    /** Ответ как 8-битное число (статус, источник...). */
+    uint8_t  asByte()        const { return bytes()[0]; }
+
+    /** Ответ как 16-битное число в формате big-endian (количество файлов, номер файла...). */
+    uint16_t asUnsignedInt() const { return ((uint16_t)bytes()[0] << 8) | bytes()[1]; }
+
+    /** Ответ как время в формате [часы] [минуты] [секунды], переведённое в секунды. */
+    uint16_t asSeconds()     const { return (bytes()[0]*60*60) + (bytes()[1]*60) + bytes()[2]; }
+};
+
+// Поля снимка состояния (AlashUartMP3Snapshot::valid и аргумент snapshot())
+#define MP3_SNAPSHOT_STATUS   0x01
+#define MP3_SNAPSHOT_INDEX    0x02
+#define MP3_SNAPSHOT_POSITION 0x04
+#define MP3_SNAPSHOT_LENGTH   0x08
+#define MP3_SNAPSHOT_NAME     0x10
+#define MP3_SNAPSHOT_ALL      0x1F
+
+/** Измеренная задержка ответа модуля на одну команду, см. AlashUartMP3::latencyStats(). */
+
+struct AlashUartMP3Latency
+{
+  uint8_t  command;    ///< Байт команды
+  uint8_t  samples;    ///< Сколько ответов учтено (не больше 255)
+  uint32_t mean;       ///< Задержка от отправки команды до начала ответа, скользящее среднее, мкс
+  uint32_t deviation;  ///< Среднее отклонение от неё, мкс
+};
+
+/** Снимок состояния модуля, см. AlashUartMP3::snapshot(). */
+
+struct AlashUartMP3Snapshot
+{
+  uint8_t  status;     ///< MP3_STATUS_...
+  uint16_t index;      ///< Номер FAT текущего файла
+  uint16_t position;   ///< Позиция воспроизведения, секунды
+  uint16_t length;     ///< Длина текущего файла, секунды
+  char     name[12];   ///< Имя текущего файла, как в currentFileName()
+  uint8_t  valid;      ///< Какие поля получены (MP3_SNAPSHOT_...)
+  uint32_t micros;     ///< Сколько длился снимок, мкс
+};
+
+#if MP3_METRICS
+/** Статистика обмена с модулем, см. AlashUartMP3::getMetrics(). */
+
+struct AlashUartMP3Metrics
+{
+  uint32_t bytesTx;                     ///< Отправлено байтов
+  uint32_t bytesRx;                     ///< Принято байтов
+  uint16_t timeouts;                    ///< Запросов, не дождавшихся ответа
+  uint16_t checksumErrors;              ///< Ответов с неверной контрольной суммой
+  uint16_t resyncs;                     ///< Брошенных (оборванных или испорченных) кадров
+  uint16_t unsolicited;                 ///< Кадров, присланных модулем самостоятельно
+  uint32_t framesCoalesced;             ///< Кадров, не отправленных благодаря объединению volumeUp()/volumeDn()
+  uint32_t framesSuppressed;            ///< Кадров, не отправленных, т.к. модуль уже в этом состоянии
+  uint32_t statusRequeries;             ///< Повторных запросов статуса из-за неожиданного ответа
+  uint32_t statusQueriesSaved;          ///< Запросов статуса, не понадобившихся по сравнению с N согласованными подряд
+  uint16_t storeWrites;                 ///< Записей настроек в хранилище
+  uint16_t storeWritesSkipped;          ///< Записей, не понадобившихся, т.к. настройки вернулись к уже записанным
+  uint16_t lateResponses;               ///< Ответов, пришедших уже после таймаута
+  uint32_t waitMicros;                  ///< Сколько блокирующие вызовы проспали или отдали другим задачам (setWaitStrategy()), мкс
+  uint16_t commands[MP3_METRICS_COMMANDS];                    ///< Отправлено команд, по байту команды
+  uint16_t latency[MP3_METRICS_COMMANDS][MP3_METRICS_BUCKETS]; ///< Гистограмма времени от отправки до ответа, по байту команды
+};
+#endif
+
+/** Кадр команды без данных `AA [CMD] 00 [SUM]`, собранный при компиляции и хранящийся во флеш-памяти (PROGMEM).
+ *
+ *  Для каждой такой команды из таблицы MP3_CMD_... компилятор создаёт свой экземпляр (4 байта флеш-памяти),
+ *  так что play(), stop() и т.п. не считают контрольную сумму и не собирают кадр при каждом вызове.
+ */
+
+template<uint8_t Command> struct AlashUartMP3FixedFrame
+{
+  static const uint8_t bytes[4];
+};
+
+template<uint8_t Command> const uint8_t AlashUartMP3FixedFrame<Command>::bytes[4] PROGMEM = { 0xAA, Command, 0x00, (uint8_t)(0xAA + Command) };
+
+class AlashUartMP3FolderIndex;
+class AlashUartMP3Group;
+class AlashUartMP3Store;
+
 class AlashUartMP3
 {
+  friend class AlashUartMP3Sim;   // Модель модуля пользуется той же таблицей команд
+  friend class AlashUartMP3Group; // Группа ждёт способом ожидания модуля (waitIdle(), idleMicros())
+
   protected:
      Stream *_Serial; ///< Set in the constructor, the stream (eg HardwareSerial or SoftwareSerial object) that connects us to the device.
 
@@ -329,12 +607,16 @@ class AlashUartMP3
 
     void abLoopClear();
 
-    /** Увеличение громкости на 1 (громкость от 0 до 100).
+    /** Увеличение громкости на один шаг модуля (1 из 30, около 3 по шкале 0-100).
+     *
+     *  `getVolume()` после шага - громкость модуля, пересчитанная в 0-100.
      */
 
     void volumeUp();
 
-    /** Уменьшение громкости на 1 (громкость от 0 до 100).
+    /** Уменьшение громкости на один шаг модуля (1 из 30, около 3 по шкале 0-100).
+     *
+     *  `getVolume()` после шага - громкость модуля, пересчитанная в 0-100.
      */
 
     void volumeDn();
@@ -398,7 +680,9 @@ class AlashUartMP3
 
     void setSource(byte source);
 
-    /** Возвращает текущий выбранный источник.
+    /** Возвращает текущий выбранный источник, запрашивая его у модуля.
+     *
+     *  Заодно обновляет запомненный источник (см. `refreshSource()`).
      *
      *  @return Один из следующих...
      *
@@ -409,6 +693,19 @@ class AlashUartMP3
 
     uint8_t getSource();
 
+    /** Повторно запрашивает текущий источник у модуля и запоминает его.
+     *
+     *  Библиотека запоминает источник, выбранный через `setSource()` (и после `reset()`
+     *  или смены носителя), чтобы `interjectFileByIndexNumber()`, `playFileNumberInFolderNumber()`
+     *  и `playInFolderNumber()` отправляли одну команду без предварительного запроса.
+     *  Если источник мог смениться без ведома библиотеки (например, кнопками на модуле),
+     *  вызовите эту функцию для синхронизации.
+     *
+     *  @return Текущий источник (MP3_SRC_...).
+     */
+
+    uint8_t refreshSource() { return getSource(); }
+
     /** Возвращает логическое значение, указывающее, доступен ли заданный источник (можно выбрать с помощью `setSource()`)
      *
      * @param  source Один из следующих
@@ -445,10 +742,53 @@ class AlashUartMP3
      *  стоит включить такую возможность (т.е. питать устройство через
      *  MOSFET, который вы можете включить/выключить по желанию).
      *
+     *  Сначала дожидается готовности модуля (`waitReady()`): только что включённый модуль теряет
+     *  все команды, пока загружается. Затем одной серией - остановка и настройки по умолчанию
+     *  (MP3_DEFAULT_...), причём если модуль ответил не на все проверки, то есть только что
+     *  загрузился и уже находится в настройках по умолчанию, они не отправляются повторно.
+     *
+     *  Если модуль так и не ответил за MP3_READY_TIMEOUT (например, подключён только провод TX),
+     *  команды всё равно отправляются.
      */
 
     void reset();
 
+    /** Тёплый старт: сброс только если модуль не в ожидаемом состоянии.
+     *
+     *  После перезагрузки контроллера модуль часто остаётся включённым и остановленным - тогда
+     *  повторная настройка не нужна: если модуль отвечает сразу и стоит (MP3_STATUS_STOPPED),
+     *  его настройки не трогаются (первая же установка громкости и т.п. уйдёт модулю),
+     *  иначе выполняется `reset()`.
+     *
+     *  Запросить настройки у модуля нельзя, поэтому без хранилища (`setStore()`) громкость,
+     *  эквалайзер и режим цикла после тёплого старта неизвестны (MP3_SETTING_UNKNOWN), пока их
+     *  не установят; `volumeUp()`/`volumeDn()` тогда шагают громкостью модуля, не зная её.
+     *
+     *      void setup()
+     *      {
+     *        mySerial.begin(9600);
+     *        mp3.warmStart();      // вместо mp3.reset()
+     *      }
+     *
+     * @return true, если сброс не понадобился
+     */
+
+    bool warmStart();
+
+    /** Ожидание готовности модуля: запрос доступных источников до первого ответа, сначала через
+     *  MP3_READY_PROBE_INTERVAL мс, затем всё реже, до MP3_READY_PROBE_INTERVAL_MAX мс.
+     *
+     *  Если к первому ответу проверок ушло несколько, ответы на остальные ещё ждутся (до
+     *  нижнего предела ожидания ответа). Модуль, который ответил только на последнюю проверку,
+     *  а первые (не меньше двух) потерял, только что загрузился (`readyAnswers == 1 && readyProbes > 2`);
+     *  один потерянный или опоздавший ответ за загрузку не считается.
+     *
+     * @param timeoutMs Сколько ждать, мс.
+     * @return true, если модуль ответил
+     */
+
+    bool waitReady(uint16_t timeoutMs = MP3_READY_TIMEOUT);
+
     /** Получение статуса с устройства.
      *
      * @return Один из MP3_STATUS_PAUSED, MP3_STATUS_PLAYING и MP3_STATUS_STOPPED
@@ -456,6 +796,32 @@ class AlashUartMP3
 
     byte getStatus();
 
+    /** Проверка ненадёжного статуса.
+     *
+     *  Модуль изредка сообщает не тот статус. При maxQueries > 1 `getStatus()` доверяет ответу сразу,
+     *  если он согласуется с историей: это MP3_STATUS_STOPPED (этот ответ надёжен), повтор предыдущего
+     *  статуса или то, что должно получиться после последней команды (play() - воспроизведение,
+     *  pause() - пауза...). Иначе статус запрашивается снова, пока два ответа подряд не совпадут,
+     *  но всего не больше maxQueries запросов - время ответа ограничено.
+     *
+     *  Сколько запросов это сэкономило - в getMetrics() (statusQueriesSaved, statusRequeries).
+     *
+     * @param maxQueries Не больше стольких запросов за один getStatus(), 1 - доверять первому ответу.
+     */
+
+    void setStatusChecks(uint8_t maxQueries) { statusChecks = maxQueries ? maxQueries : 1; }
+
+    /** Уверенность в последнем статусе: 0 - не подтверждён, до MP3_STATUS_CONFIDENCE_MAX - столько согласованных ответов подряд. */
+
+    uint8_t statusConfidence() { return statusTrust; }
+
+    /** Сколько всего миллисекунд модуль простоял на паузе по командам этой библиотеки:
+     *  от отправки `pause()` до следующей команды воспроизведения или остановки.
+     *  Растёт и во время текущей паузы; пауза кнопкой на модуле не учитывается.
+     */
+
+    uint32_t pausedMillis();
+
     /** Возвращает, занят ли устройство (воспроизведение) или нет.
      *
      *  Просто удобный тест, эквивалентен `getStatus() == MP3_STATUS_PLAYING`
@@ -467,7 +833,8 @@ class AlashUartMP3
 
     /** Получение текущего уровня громкости.
      *
-     * @return Значение от 0 до 100 (внутреннее значение конвертируется из диапазона 0-30 модуля)
+     * @return Значение от 0 до 100 (внутреннее значение конвертируется из диапазона 0-30 модуля),
+     *         MP3_SETTING_UNKNOWN - неизвестно (после `warmStart()` без хранилища, до `setVolume()`)
      */
 
     byte getVolume();
@@ -482,6 +849,8 @@ class AlashUartMP3
      *  *  MP3_EQ_JAZZ
      *  *  MP3_EQ_CLASSIC
      *  *  MP3_EQ_BASS
+     *
+     *  или MP3_SETTING_UNKNOWN - неизвестно (после `warmStart()` без хранилища, до `setEqualizer()`)
      */
 
     byte getEqualizer();
@@ -500,6 +869,8 @@ class AlashUartMP3
      *  *  MP3_LOOP_FOLDER        - Пройти через все файлы в одной папке и повторить.
      *  *  MP3_LOOP_FOLDER_STOP   - Пройти через все файлы в одной папке и остановиться
      *  *  MP3_LOOP_FOLDER_RANDOM - Случайно воспроизводить все файлы в одной папке (непрерывно)
+     *
+     *  или MP3_SETTING_UNKNOWN - неизвестно (после `warmStart()` без хранилища, до `setLoopMode()`)
      */
 
     byte getLoopMode();
@@ -536,15 +907,79 @@ class AlashUartMP3
 
     uint16_t   currentFileIndexNumber();
 
+    /** Количество файлов в папке текущего файла.
+     *
+     * @return Количество файлов в папке, в которой находится текущий файл.
+     */
+
+    uint16_t   currentFolderFileCount();
+
+    /** Номер FAT первого файла в папке текущего файла.
+     *
+     *  Вместе с `currentFolderFileCount()` даёт номера FAT всех файлов папки, см. `AlashUartMP3FolderIndex`.
+     *
+     * @return Номер FAT первого файла папки.
+     */
+
+    uint16_t   currentFolderFirstIndex();
+
+    /** Подключение каталога папок.
+     *
+     *  Если папка есть в каталоге, `playFileNumberInFolderNumber()` и `playInFolderNumber()`
+     *  запускают файл сразу по его номеру FAT, без поиска пути модулем (на большой карте - заметно быстрее).
+     *  Только для папок, где номера сходятся с именами (см. `AlashUartMP3FolderIndex`), остальные - по пути, как без каталога.
+     *
+     * @param index Каталог папок или NULL, чтобы отключить.
+     */
+
+    void       setFolderIndex(AlashUartMP3FolderIndex *index) { folderIndex = index; }
+
     /** Для текущего воспроизводимого или приостановленного файла, возвращает
      *  текущую позицию в секундах.
      *
+     *  Если включена подписка на позицию (`subscribePosition()`), возвращает последнюю
+     *  присланную модулем позицию без обмена с модулем.
+     *
      * @return Количество секунд, прошедших с начала файла, который сейчас воспроизводится.
      *
      */
 
     uint16_t   currentFilePositionInSeconds();
 
+    /** Включение постоянной отчётности о позиции воспроизведения.
+     *
+     *  Модуль будет раз в секунду присылать текущую позицию, библиотека разбирает эти
+     *  отчёты в `poll()` (и во время любых других команд) и запоминает последнюю позицию,
+     *  так что `currentFilePositionInSeconds()` и `lastPositionInSeconds()` больше не
+     *  обращаются к модулю.
+     *
+     *      mp3.subscribePosition();
+     *
+     *      void loop()
+     *      {
+     *        mp3.poll();
+     *        drawProgress(mp3.lastPositionInSeconds());
+     *      }
+     */
+
+    void subscribePosition();
+
+    /** Выключение постоянной отчётности о позиции воспроизведения. */
+
+    void unsubscribePosition();
+
+    /** Включена ли подписка на позицию воспроизведения. */
+
+    bool positionSubscribed() { return positionSubscription; }
+
+    /** Последняя позиция воспроизведения, присланная модулем, в секундах (без обмена с модулем). */
+
+    uint16_t lastPositionInSeconds() { return lastPosition; }
+
+    /** Время (`millis()`) получения последней позиции воспроизведения, 0 - позиция ещё не приходила. */
+
+    uint32_t lastPositionMillis() { return lastPositionAt; }
+
     /** Для текущего воспроизводимого или приостановленного файла, возвращает
      *  общую длину файла в секундах.
      *
@@ -574,6 +1009,31 @@ class AlashUartMP3
 
     void           currentFileName(char *buffer, uint16_t bufferLength);
 
+    /** Снимок состояния: статус, номер, позиция, длина и имя текущего файла за один обмен.
+     *
+     *  Вместо пяти блокирующих вызовов подряд (каждый ждёт свой ответ) запросы уходят модулю один за другим,
+     *  не дожидаясь ответов, а ответы разбираются по байту команды по мере прихода.
+     *
+     *      AlashUartMP3Snapshot s;
+     *      if(mp3.snapshot(s) == MP3_SNAPSHOT_ALL)
+     *      {
+     *        Serial.print(s.name);
+     *        Serial.print(' ');
+     *        Serial.print(s.position);
+     *        Serial.print('/');
+     *        Serial.println(s.length);
+     *      }
+     *
+     *  Если включена подписка на позицию (subscribePosition()), позиция берётся из последнего отчёта.
+     *  Статус - один ответ модуля, без повторных запросов getStatus().
+     *
+     * @param snapshot Куда записать результат.
+     * @param fields   Какие поля запросить (MP3_SNAPSHOT_..., по умолчанию все).
+     * @return Какие поля получены (snapshot.valid).
+     */
+
+    uint8_t        snapshot(AlashUartMP3Snapshot &snapshot, uint8_t fields = MP3_SNAPSHOT_ALL);
+
     /** Воспроизведение последовательности файлов, которые должны все существовать в папке, называемой "ZH", и иметь имена 00.mp3 через 99.mp3
      *
      * Не спрашивайте меня, почему папка должна называться "ZH", это то, что хочет JQ8400.
@@ -593,12 +1053,45 @@ class AlashUartMP3
      *
      * обратите внимание, что имена файлов состоят из 2 цифр, "`1.mp3`" не является допустимым.
      *
+     * Имена передаются модулю прямо из массива, без копии в памяти, в одном списке - не больше
+     * MP3_SEQUENCE_MAX (127) файлов; более длинный список не отправляется и не обрезается
+     * (длинные программы - см. `AlashUartMP3Playlist`).
+     *
      * @param playList An array of the numbers of files in the "ZH" folder.
      * @param listLength          Number of filenames in the list.
+     * @return MP3_RESULT_OK или MP3_RESULT_TOO_LONG, если в списке больше MP3_SEQUENCE_MAX файлов.
+     *
+     */
+
+    uint8_t playSequenceByFileNumber(uint8_t playList[], uint8_t listLength);
+
+    /** То же, что `playSequenceByFileNumber()`, но список хранится во флеш-памяти.
+     *
+     *     const uint8_t playList[] PROGMEM = { 3, 1, 2 };
+     *     mp3.playSequenceByFileNumber_P(playList, sizeof(playList));
+     *
+     * @param playList   Массив номеров файлов в папке "ZH" в PROGMEM.
+     * @param listLength Количество файлов в списке, не больше MP3_SEQUENCE_MAX.
+     * @return MP3_RESULT_OK или MP3_RESULT_TOO_LONG.
+     */
+
+    uint8_t playSequenceByFileNumber_P(const uint8_t *playList, uint8_t listLength);
+
+    /** То же, что `playSequenceByFileNumber()`, но номера выдаёт функция - список нигде не хранится целиком.
      *
+     *     uint8_t countdown(uint8_t position, void *context) { return 10 - position; }
+     *
+     *     mp3.playSequence(countdown, 10); // 10.mp3, 09.mp3 ... 01.mp3
+     *
+     *  Функция вызывается во время отправки, по два раза на каждый файл (по разу на каждую цифру имени).
+     *
+     * @param source     Функция, возвращающая номер файла в папке "ZH" по номеру элемента списка.
+     * @param listLength Количество файлов в списке, не больше MP3_SEQUENCE_MAX.
+     * @param context    Указатель, передаваемый функции.
+     * @return MP3_RESULT_OK или MP3_RESULT_TOO_LONG.
      */
 
-    void playSequenceByFileNumber(uint8_t playList[], uint8_t listLength);
+    uint8_t playSequence(MP3SequenceSource source, uint8_t listLength, void *context = 0);
 
     /** Воспроизведение последовательности файлов, которые должны все существовать в папке, называемой "ZH", и иметь имена из 2 символов.
      *
@@ -618,13 +1111,326 @@ class AlashUartMP3
      *     mp3.playSequenceByFileName(playList, sizeof(playList)/sizeof(char *));
      *
      * @param playList   An array of the two character names (as strings).
-     * @param listLength Number of filenames in the list.
+     * @param listLength Number of filenames in the list, не больше MP3_SEQUENCE_MAX.
+     * @return MP3_RESULT_OK или MP3_RESULT_TOO_LONG.
      *
      */
 
-    void playSequenceByFileName(const char *playList[], uint8_t listLength);
+    uint8_t playSequenceByFileName(const char *playList[], uint8_t listLength);
 
+    /** @name Асинхронный режим
+     *
+     *  Все команды проходят через одну очередь фиксированного размера (MP3_QUEUE_SIZE),
+     *  отправка и приём выполняются конечным автоматом внутри `poll()`, который никогда
+     *  не ждёт - он только обрабатывает уже пришедшие байты и, если линия свободна,
+     *  отправляет следующую команду.
+     *
+     *  Обычные (блокирующие) методы ставят команду в ту же очередь и вызывают `poll()`,
+     *  пока она не завершится, поэтому их можно свободно смешивать с асинхронными.
+     *
+     *      void setup()
+     *      {
+     *        mySerial.begin(9600);
+     *        mp3.reset();
+     *        mp3.setAsync(true); // play(), setVolume() и т.п. больше не ждут отправки
+     *      }
+     *
+     *      void loop()
+     *      {
+     *        mp3.poll();       // вызывать как можно чаще
+     *        animateLeds();    // не блокируется обменом с модулем
+     *      }
+     */
+    ///@{
+
+    /** Продвижение конечного автомата приёма/передачи, без ожидания.
+     *
+     *  Вызывайте в `loop()` как можно чаще, если используются асинхронные запросы или `setAsync(true)`.
+     */
 
+    void poll();
+
+    /** Включение асинхронного режима для команд без ответа.
+     *
+     *  В асинхронном режиме play(), stop(), setVolume() и другие команды без ответа
+     *  только ставятся в очередь и отправляются из `poll()`.  Если очередь заполнена,
+     *  вызов дождётся освобождения места.  Запросы с ответом (getStatus() и т.п.) по-прежнему блокирующие,
+     *  для них используйте методы request...().
+     *
+     * @param async true - не ждать отправки команд без ответа
+     */
+
+    void setAsync(bool async) { asyncMode = async; }
+
+    /** Возвращает true, если очередь пуста и ответ ни на что не ожидается. */
+
+    bool idle() { return queueCount == 0; }
+
+    /** Блокирующее ожидание, пока все команды из очереди не будут отправлены и не получат ответ. */
+
+    void flush();
+
+    /** Начало пакета команд.
+     *
+     *  Команды без ответа, вызванные до `endBatch()`, и в блокирующем режиме только ставятся в очередь
+     *  и сразу возвращают MP3_RESULT_OK, а затем уходят одной непрерывной серией, разделённые лишь
+     *  минимальной паузой (`setInterFrameGap()`). Если очередь заполнится, накопленное отправляется
+     *  и пакет набирается дальше; запрос с ответом внутри пакета дожидается отправки накопленного и своего ответа,
+     *  после него пакет тоже продолжается.
+     *
+     *      mp3.beginBatch();
+     *      mp3.setVolume(80);
+     *      mp3.setEqualizer(MP3_EQ_POP);
+     *      mp3.setLoopMode(MP3_LOOP_ALL);
+     *      mp3.playFileByIndexNumber(12);
+     *      mp3.endBatch();
+     */
+
+    void beginBatch() { batchHold = true; }
+
+    /** Конец пакета команд: отправка всего накопленного.
+     *
+     *  Без `setAsync(true)` ждёт, пока всё не будет отправлено, в асинхронном режиме - отправляет из `poll()`.
+     */
+
+    void endBatch();
+
+    /** Минимальная пауза на линии между концом одного кадра команды и началом следующего.
+     *
+     * @param micros Пауза, мкс (по умолчанию MP3_FRAME_GAP), 0 - кадры идут вплотную.
+     */
+
+    void setInterFrameGap(uint16_t micros) { frameGap = micros; }
+
+    /** Скорость, на которой открыт порт модуля (по умолчанию 9600), нужна для расчёта паузы между кадрами. */
+
+    void setBaudRate(uint32_t baud) { byteTime = baud ? 10000000UL / baud : 0; }
+
+    /** Пределы таймаутов приёма ответа.
+     *
+     *  Библиотека измеряет, через сколько после отправки каждой команды модуль начинает отвечать
+     *  (скользящее среднее и среднее отклонение, как RTO в TCP) и какие паузы бывают между байтами ответа,
+     *  и ждёт ответа среднее плюс MP3_TIMEOUT_DEVIATIONS отклонений, но не меньше нижнего предела
+     *  и не больше верхнего. Пропавший ответ задерживает здоровый модуль на десятки миллисекунд, а не на секунду;
+     *  после таймаута ожидание этой команды удваивается, опоздавший ответ тоже учитывается.
+     *
+     *  Чтобы вернуть постоянные таймауты, задайте одинаковые пределы:
+     *
+     *      mp3.setTimeoutLimits(1000, 1000, 150, 150);
+     *
+     * @param firstByteMinMs Нижний предел ожидания начала ответа, мс (MP3_TIMEOUT_FIRST_BYTE_MIN).
+     * @param firstByteMaxMs Верхний предел и ожидание, пока задержка команды не измерена, мс (MP3_TIMEOUT_FIRST_BYTE).
+     * @param interByteMinMs Нижний предел паузы между байтами ответа, мс (MP3_TIMEOUT_INTERBYTE_MIN).
+     * @param interByteMaxMs Верхний предел паузы между байтами ответа, мс (MP3_TIMEOUT_INTERBYTE).
+     */
+
+    void setTimeoutLimits(uint16_t firstByteMinMs, uint16_t firstByteMaxMs,
+                          uint16_t interByteMinMs = MP3_TIMEOUT_INTERBYTE_MIN, uint16_t interByteMaxMs = MP3_TIMEOUT_INTERBYTE);
+
+    /** Сколько сейчас ждать начала ответа на команду.
+     *
+     * @param command Байт команды (как в latencyStats()).
+     * @return Таймаут, мс
+     */
+
+    uint16_t responseTimeout(uint8_t command);
+
+    /** Сколько сейчас ждать следующего байта ответа, мс. */
+
+    uint16_t interByteTimeout() { return interByteTimeoutMs; }
+
+    /** Измеренные задержки ответов: по одной записи на команду, от 0 до MP3_LATENCY_SLOTS-1.
+     *
+     *      const AlashUartMP3Latency *l;
+     *      for(uint8_t n = 0; (l = mp3.latencyStats(n)) != NULL; n++)
+     *      {
+     *        Serial.print(l->command, HEX);
+     *        Serial.print(' ');
+     *        Serial.println(l->mean);
+     *      }
+     *
+     * @return Запись или NULL, если такой нет
+     */
+
+    const AlashUartMP3Latency *latencyStats(uint8_t n) { return n < MP3_LATENCY_SLOTS && latencies[n].samples ? &latencies[n] : NULL; }
+
+    /** Как ждать в блокирующих вызовах (getStatus(), flush(), reset()...), пока модуль передаёт или готовит ответ.
+     *
+     *  По умолчанию MP3_WAIT_SPIN - порт опрашивается непрерывно. На ESP32 это всё время ядра: задачи с меньшим
+     *  приоритетом, WiFi и сторожевой таймер простоя его не получают. MP3_WAIT_SLEEP засыпает до ожидаемого прихода
+     *  ответа (по измеренной задержке команды, см. latencyStats()), конца принимаемого кадра или паузы между кадрами,
+     *  пришедшие за это время байты ждут в буфере порта.
+     *
+     * @param strategy MP3_WAIT_SPIN, MP3_WAIT_YIELD или MP3_WAIT_SLEEP.
+     */
+
+    void setWaitStrategy(uint8_t strategy) { waitStrategy = strategy; waitHandler = 0; }
+
+    /** Своя функция ожидания вместо стратегии setWaitStrategy().
+     *
+     *  Функция получает, сколько можно не опрашивать порт, и может вернуться раньше - например, по уведомлению
+     *  драйвера порта о приходе байтов (см. AlashUartMP3Notifier):
+     *
+     *      AlashUartMP3Notifier rxEvent;
+     *
+     *      Serial2.onReceive([]() { rxEvent.notify(); });
+     *      mp3.setWaitHandler(AlashUartMP3Notifier::wait, &rxEvent, true);
+     *
+     * @param handler      Функция или NULL - вернуться к стратегии.
+     * @param context      Указатель, передаваемый функции.
+     * @param wakesOnInput Возвращается ли функция сама, когда приходят байты: тогда ей отдаётся всё время
+     *                     до ближайшего срока (таймаута ответа, паузы между кадрами), а не до ожидаемого прихода ответа.
+     */
+
+    void setWaitHandler(MP3WaitHandler handler, void *context = 0, bool wakesOnInput = false)
+    {
+      waitHandler = handler;
+      waitContext = context;
+      waitWakes   = wakesOnInput;
+    }
+
+    /** Объединение команд громкости и пропуск повторных настроек.
+     *
+     *  При включённом объединении:
+     *
+     *   * volumeUp()/volumeDn() только меняют запомненную громкость, а модулю через deadlineMs
+     *     после первого из них уходит одна команда установки громкости (из poll(), flush()
+     *     или любой блокирующей функции), так что ручка-энкодер не забивает линию; каждый шаг -
+     *     это шаг модуля (1 из 30), как у отдельных команд VOL_UP/VOL_DN без объединения;
+     *   * setVolume(), setEqualizer(), setLoopMode() ничего не отправляют, если модуль
+     *     уже находится в этом состоянии (после reset() состояние считается неизвестным до первой настройки).
+     *
+     *  Сколько кадров это сэкономило, возвращает getFramesSaved() (всегда), а по отдельности -
+     *  getMetrics() (framesCoalesced, framesSuppressed; только при MP3_METRICS, на AVR по умолчанию выключено).
+     *
+     *      mp3.setCoalescing(true, 30);
+     *
+     *      void loop()
+     *      {
+     *        mp3.poll();
+     *        if(knobTurnedRight()) mp3.volumeUp();
+     *        if(knobTurnedLeft())  mp3.volumeDn();
+     *      }
+     *
+     * @param enable     Включить объединение (по умолчанию выключено), при выключении накопленное отправляется сразу.
+     * @param deadlineMs Максимальная задержка отправки громкости, мс.
+     */
+
+    void setCoalescing(bool enable, uint16_t deadlineMs = MP3_COALESCE_DEADLINE);
+
+    /** Сколько кадров не было отправлено благодаря объединению громкости и пропуску повторных настроек
+     *  (framesCoalesced + framesSuppressed из getMetrics(), но без MP3_METRICS).
+     */
+
+    uint32_t getFramesSaved() { return framesSaved; }
+
+    /** Включение модуля в группу (вызывается из `AlashUartMP3Group::add()`).
+     *
+     *  Пока модуль ждёт в блокирующем вызове, он обслуживает остальные модули группы.
+     *
+     * @param group Группа или NULL, чтобы исключить модуль из неё.
+     */
+
+    void setGroup(AlashUartMP3Group *group) { this->group = group; }
+
+    /** Постоянное хранение настроек: громкость, эквалайзер, режим цикла и источник переживают выключение питания.
+     *
+     *  Изменённые настройки записываются из `poll()` через delayMs после последнего изменения (вызывайте
+     *  `poll()` в `loop()`), и только если они отличаются от уже записанных. `reset()` и `warmStart()`
+     *  выставляют модулю сохранённые настройки вместо MP3_DEFAULT_... одной серией команд.
+     *
+     *      AlashUartMP3EepromStore store(0);
+     *
+     *      void setup()
+     *      {
+     *        mp3.setStore(&store);
+     *        mp3.reset();            // громкость и т.д. - как перед выключением
+     *      }
+     *
+     * @param store   Хранилище (см. AlashUartMP3Store) или NULL, чтобы отключить.
+     * @param delayMs Через сколько миллисекунд после последнего изменения записывать.
+     */
+
+    void setStore(AlashUartMP3Store *store, uint16_t delayMs = MP3_STORE_DELAY);
+
+    /** Запись изменившихся настроек в хранилище сейчас, не дожидаясь задержки (например, перед выключением).
+     *
+     * @return true, если запись понадобилась и удалась
+     */
+
+    bool saveState();
+
+    /** Асинхронный запрос статуса, результат - `request.asByte()` (MP3_STATUS_...).
+     *
+     * @return false, если очередь заполнена (запрос не поставлен)
+     */
+
+    bool requestStatus(AlashUartMP3Request &request)                   { return queueRequest(MP3_CMD_STATUS, request); }
+
+    /** Асинхронный запрос количества файлов, результат - `request.asUnsignedInt()`. */
+
+    bool requestCountFiles(AlashUartMP3Request &request)               { return queueRequest(MP3_CMD_COUNT_FILES, request); }
+
+    /** Асинхронный запрос номера FAT текущего файла, результат - `request.asUnsignedInt()`. */
+
+    bool requestCurrentFileIndexNumber(AlashUartMP3Request &request)   { return queueRequest(MP3_CMD_CURRENT_FILE_IDX, request); }
+
+    /** Асинхронный запрос длины текущего файла, результат - `request.asSeconds()`. */
+
+    bool requestCurrentFileLengthInSeconds(AlashUartMP3Request &request) { return queueRequest(MP3_CMD_CURRENT_FILE_LEN, request); }
+
+    /** Асинхронный запрос имени текущего файла, имя записывается в `request.responseBuffer` (не завершается нулём). */
+
+    bool requestCurrentFileName(AlashUartMP3Request &request)          { return queueRequest(MP3_CMD_CURRENT_FILE_NAME, request); }
+
+    /** Асинхронный запрос битовой маски доступных источников, результат - `request.asByte()`. */
+
+    bool requestAvailableSources(AlashUartMP3Request &request)         { return queueRequest(MP3_CMD_GET_SOURCES, request); }
+
+    /** Обработчик отчётов о позиции воспроизведения, которые модуль присылает сам (раз в секунду после MP3_CMD_CURRENT_FILE_POS).
+     *
+     * @param handler Функция (или NULL, чтобы отключить).
+     * @param context Произвольные данные, передаются в функцию.
+     */
+
+    void onPositionReport(MP3PositionHandler handler, void *context = 0) { positionHandler = handler; positionContext = context; }
+
+    /** Обработчик всех прочих кадров, которые модуль прислал сам, а не в ответ на запрос
+     *  (например, уведомления об окончании трека, если прошивка модуля их присылает).
+     *
+     * @param handler Функция (или NULL, чтобы отключить).
+     * @param context Произвольные данные, передаются в функцию.
+     */
+
+    void onUnsolicitedFrame(MP3FrameHandler handler, void *context = 0) { unsolicitedHandler = handler; unsolicitedContext = context; }
+
+    ///@}
+
+#if MP3_METRICS
+    /** @name Статистика обмена
+     *
+     *  Доступна, если MP3_METRICS не 0 (по умолчанию - везде, кроме AVR).
+     */
+    ///@{
+
+    /** Текущая статистика обмена с модулем. */
+
+    const AlashUartMP3Metrics &getMetrics() { return metrics; }
+
+    /** Обнуление статистики. */
+
+    void resetMetrics() { memset(&metrics, 0, sizeof(metrics)); }
+
+    /** Вывод статистики в формате CSV, например `mp3.dumpMetrics(Serial);`
+     *
+     *  Сначала общие счётчики (`metric,value`), затем по каждой отправлявшейся команде
+     *  (`command,count,lt2ms,lt5ms,lt10ms,lt20ms,lt50ms,lt100ms,lt200ms,ge200ms`).
+     */
+
+    void dumpMetrics(Print &out);
+
+    ///@}
+#endif
 
   protected:
 
@@ -636,18 +1442,19 @@ class AlashUartMP3
      * @param responseBuffer Buffer to store a single line of response, if NULL, no response is read.  Note that the response is NOT a null-terminated string, if you want that, do it yourself (and specify length-1).
      * @param buffLength     Length of response buffer.
      *
+     * @return MP3_RESULT_OK, MP3_RESULT_CHECKSUM или MP3_RESULT_TIMEOUT (если ответ не запрашивался - всегда MP3_RESULT_OK)
      */
 
-    void sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength);
+    uint8_t sendCommandData(uint8_t command, uint8_t *requestBuffer, uint8_t requestLength, uint8_t *responseBuffer, uint8_t bufferLength);
 
     /** Отправка команды с нулевыми аргументами и без ответа.
      *
      * @param command       Byte value of to send as from the datasheet.
      */
 
-    inline void sendCommand(uint8_t command, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
+    inline uint8_t sendCommand(uint8_t command, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
     {
-      sendCommandData(command, NULL,  0, responseBuffer, bufferLength);
+      return sendCommandData(command, NULL,  0, responseBuffer, bufferLength);
     }
 
     /** Отправка команды с одним 8-битным аргументом и без ответа.
@@ -656,9 +1463,9 @@ class AlashUartMP3
      * @param arg           Single byte of data
      */
 
-    inline void sendCommand(uint8_t command, uint8_t arg, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
+    inline uint8_t sendCommand(uint8_t command, uint8_t arg, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
     {
-      sendCommandData(command, &arg, 1, responseBuffer, bufferLength);
+      return sendCommandData(command, &arg, 1, responseBuffer, bufferLength);
     }
 
     /** Отправка команды с 16-битным целым аргументом.
@@ -667,16 +1474,34 @@ class AlashUartMP3
      * @param arg           16 bit uint16_teger data
      */
 
-    inline void sendCommand(uint8_t command, uint16_t arg, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
+    inline uint8_t sendCommand(uint8_t command, uint16_t arg, uint8_t *responseBuffer = 0, uint8_t bufferLength = 0)
     {
       #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-        sendCommandData(command, ((uint8_t *)(&arg)), 2, responseBuffer, bufferLength);
+        return sendCommandData(command, ((uint8_t *)(&arg)), 2, responseBuffer, bufferLength);
       #else
         uint8_t buf[] = { *(((uint8_t *)(&arg))+1), *((uint8_t *)(&arg)) };
-        sendCommandData(command, buf, 2, responseBuffer, bufferLength);
+        return sendCommandData(command, buf, 2, responseBuffer, bufferLength);
       #endif
     }
 
+    /** Отправка команды без данных и без ответа готовым кадром, собранным при компиляции.
+     *
+     *      this->sendFixedCommand<MP3_CMD_PLAY>();
+     */
+
+    template<uint8_t Command> inline uint8_t sendFixedCommand()
+    {
+      return sendFixedFrame(AlashUartMP3FixedFrame<Command>::bytes);
+    }
+
+    /** Отправка готового кадра `AA [CMD] 00 [SUM]` из флеш-памяти.
+     *
+     *  Если очередь пуста, пакет не набирается и пауза между кадрами выдержана - кадр сразу уходит
+     *  одним вызовом write(), минуя очередь, иначе команда ставится в очередь обычным порядком.
+     */
+
+    uint8_t sendFixedFrame(const uint8_t *fixedFrame);
+
     /** Отправка команды на модуль JQ8400, и получение 16-битного целочисленного ответа.
      *
      * @param command        Byte value of to send as from the datasheet.
@@ -705,18 +1530,383 @@ class AlashUartMP3
 
     uint8_t getAvailableSources();
 
-    /** Блокирующий ожидание с таймаутом для последовательного ввода.
+    /** Постановка запроса с ответом в очередь без ожидания.
+     *
+     * @param command  Byte value of to send as from the datasheet.
+     * @param request  Объект запроса, должен существовать до завершения.
+     * @return false, если очередь заполнена
+     */
+
+    bool queueRequest(uint8_t command, AlashUartMP3Request &request);
+
+    /** Блокирующая отправка команды, данные которой выдаёт функция по одному байту прямо в кадр.
+     *
+     *  Память не зависит от длины данных - ни список, ни кадр целиком нигде не хранятся.
+     *
+     * @param command Байт команды.
+     * @param length  Длина данных.
+     * @param source  Функция, выдающая байт данных по смещению.
+     * @param context Указатель, передаваемый функции.
+     * @return MP3_RESULT_..., MP3_RESULT_TOO_LONG (ничего не отправлено) при длине больше 255
+     */
+
+    uint8_t sendCommandGenerated(uint8_t command, uint16_t length, MP3PayloadSource source, void *context);
+
+    /** Источник и его указатель для `playSequence()`. */
+
+    struct SequenceSource
+    {
+      MP3SequenceSource source;
+      void             *context;
+    };
+
+    static uint8_t numberListByte(uint8_t offset, void *context);
+    static uint8_t numberListByte_P(uint8_t offset, void *context);
+    static uint8_t nameListByte(uint8_t offset, void *context);
+    static uint8_t sequenceByte(uint8_t offset, void *context);
+
+    /** Постановка команды в очередь.
+     *
+     *  Данные длиной до MP3_QUEUE_PAYLOAD_SIZE копируются в очередь, более длинные
+     *  хранятся по указателю - вызывающий код обязан дождаться отправки.
+     *
+     * @param command        Byte value of to send as from the datasheet.
+     * @param requestBuffer  Pointer to (or NULL) request data bytes.
+     * @param requestLength  Number of bytes in the request buffer.
+     * @param request        Объект запроса (или NULL), завершается по ответу или сразу после отправки.
+     * @param expectResponse Ожидать ли ответный кадр.
+     * @param wait           Если очередь заполнена - ждать места (true) или вернуть false.
+     * @return true, если команда поставлена в очередь
+     */
+
+    bool enqueue(uint8_t command, const uint8_t *requestBuffer, uint8_t requestLength, AlashUartMP3Request *request, bool expectResponse, bool wait);
+
+    /** Отправка кадра команды из головы очереди.
+     *
+     *  Кадр собирается в буфере на стеке и передаётся одним вызовом `write(buffer, length)`,
+     *  а не побайтно - на SoftwareSerial и HardwareSerial ESP32 каждый вызов write() стоит дорого.
+     */
+
+    void transmit();
+
+    /** Учёт отправленного кадра: время отправки, когда он закончится на линии, статистика. */
+
+    void frameSent(uint8_t command, uint8_t frameLength);
+
+    /** Выдержана ли пауза между кадрами после окончания последнего кадра на линии. */
+
+    bool frameGapElapsed()
+    {
+      return !frameGap || (int32_t)(micros() - (txWireEndAt + frameGap)) >= 0;
+    }
+
+    /** Завершение команды в голове очереди и удаление её из очереди.
+     *
+     * @param result MP3_RESULT_OK, MP3_RESULT_CHECKSUM или MP3_RESULT_TIMEOUT
+     */
+
+    void completeHead(uint8_t result);
+
+    /** Обработка одного принятого байта. */
+
+    void handleRxByte(uint8_t b);
+
+    /** Разбор одного байта и обработка законченного кадра.
+     *
+     *  Если кадр не сложился (неверная длина или контрольная сумма), его байты после 0xAA
+     *  разбираются заново - настоящий кадр мог начаться внутри мусора. Повторный разбор идёт
+     *  циклом по одному буферу (MP3_RX_BUFFER_SIZE + 3 байта на стеке), сколько бы 0xAA ни было в мусоре.
+     */
+
+    void feedByte(uint8_t b);
+
+    /** Обработка правильного кадра: ответ на текущий запрос (по байту команды) или кадр, присланный модулем самостоятельно. */
+
+    void dispatchFrame();
+
+    /** Запись кадра в заполняемый снимок, если это ответ на один из его запросов.
+     *
+     * @return true, если кадр использован
+     */
+
+    bool fillSnapshot();
+
+    /** Ожидает ли текущий (отправленный) запрос ответ с таким байтом команды. */
+
+    bool awaitingResponse(uint8_t command)
+    {
+      return queueCount && (queue[queueHead].flags & MP3_ENTRY_SENT) && queue[queueHead].command == command;
+    }
+
+    /** Приём всех уже пришедших байтов (`handleRxByte()` для каждого, rxBacklog - сколько байтов осталось за ним).
+     *
+     *  Здесь каждый байт - это два виртуальных вызова Stream, `AlashUartMP3Serial` заменяет их прямыми
+     *  (сам `receive()` остаётся виртуальным).
+     */
+
+    virtual void receive();
+
+    /** Передача байтов кадра модулю. */
+
+    virtual void send(const uint8_t *buffer, uint8_t length);
+
+    /** Один шаг блокирующего ожидания: `waitIdle()`, затем `poll()` этого модуля и остальных модулей его группы. */
+
+    void waitStep();
+
+    /** Сколько можно не опрашивать порт: до ближайшего срока обмена (таймаут ответа, обрыв кадра, пауза между кадрами),
+     *  а если ожидание не прерывается приходом байтов - и до ожидаемого прихода ответа или конца кадра.
+     *
+     * @return мкс, не больше MP3_WAIT_MAX; 0 - работа есть уже сейчас
+     */
+
+    uint32_t idleMicros(bool wakesOnInput);
+
+    /** Ожидание выбранным способом (setWaitStrategy(), setWaitHandler()), не дольше limitMicros. */
+
+    void waitIdle(uint32_t limitMicros = MP3_WAIT_MAX);
+
+    /** Сколько микросекунд осталось до момента at (0 - уже наступил). */
+
+    static uint32_t remaining(uint32_t at, uint32_t now) { return (int32_t)(at - now) > 0 ? at - now : 0; }
+
+    /** Разбор очередного принятого байта кадра `AA [CMD] [LEN] [DATA] [SUM]`.
+     *
+     *  Пока не найден байт начала кадра 0xAA, все остальные байты отбрасываются (ресинхронизация).
+     *  Кадр считается законченным сразу после байта контрольной суммы, длина берётся из байта LEN.
      *
-     * @param maxWaitTime Milliseconds
-     * @return bool Available (True) / Timed Out (False)
+     * @param b Принятый байт.
+     * @return MP3_FRAME_INCOMPLETE, MP3_FRAME_OK (кадр в rxCommand/rxBuffer/rxCount), MP3_FRAME_BAD (не сошлась контрольная сумма)
+     *         или MP3_FRAME_BAD_LENGTH (длина больше MP3_RX_BUFFER_SIZE)
      */
 
-    int    waitUntilAvailable(uint16_t maxWaitTime = 1000);
+    uint8_t parseFrameByte(uint8_t b);
+
+    static const uint8_t MP3_FRAME_INCOMPLETE = 0;
+    static const uint8_t MP3_FRAME_OK         = 1;
+    static const uint8_t MP3_FRAME_BAD        = 2;
+    static const uint8_t MP3_FRAME_BAD_LENGTH = 3;
+
+    static const uint8_t MP3_RX_WAIT_BEGIN = 0;
+    static const uint8_t MP3_RX_COMMAND    = 1;
+    static const uint8_t MP3_RX_LENGTH     = 2;
+    static const uint8_t MP3_RX_DATA       = 3;
+    static const uint8_t MP3_RX_CHECKSUM   = 4;
+
+    uint8_t rxState    = MP3_RX_WAIT_BEGIN; ///< Состояние разбора принимаемого кадра
+    uint8_t rxCommand  = 0;                 ///< Байт команды принимаемого кадра
+    uint8_t rxLength   = 0;                 ///< Количество байтов данных (из байта LEN)
+    uint8_t rxCount    = 0;                 ///< Сколько байтов данных уже принято
+    uint8_t rxChecksum = 0;                 ///< Накопленная контрольная сумма
+    uint8_t rxBuffer[MP3_RX_BUFFER_SIZE];   ///< Данные принимаемого кадра
+
+    /** Элемент очереди команд. */
+    struct QueueEntry
+    {
+      uint8_t command;                         ///< Байт команды
+      uint8_t length;                          ///< Количество байтов данных
+      uint8_t flags;                           ///< MP3_ENTRY_...
+      union
+      {
+        uint8_t        data[MP3_QUEUE_PAYLOAD_SIZE]; ///< Данные, если помещаются
+        const uint8_t *external;                     ///< Данные по указателю (MP3_ENTRY_EXTERNAL)
+        struct
+        {
+          MP3PayloadSource source;
+          void            *context;
+        } generator;                                 ///< Данные выдаёт функция (MP3_ENTRY_GENERATED)
+      };
+      AlashUartMP3Request *request;            ///< Кого уведомить о завершении (может быть NULL)
+    };
+
+    static const uint8_t MP3_ENTRY_RESPONSE = 0x01; ///< Ждать ответный кадр
+    static const uint8_t MP3_ENTRY_SENT     = 0x02; ///< Кадр уже отправлен, ждём ответ
+    static const uint8_t MP3_ENTRY_EXTERNAL = 0x04; ///< Данные хранятся по указателю
+    static const uint8_t MP3_ENTRY_GENERATED = 0x08; ///< Данные выдаёт функция по одному байту
+
+    QueueEntry queue[MP3_QUEUE_SIZE];    ///< Кольцевая очередь команд, в голове - текущая
+    uint8_t    queueHead  = 0;           ///< Индекс головы очереди
+    uint8_t    queueCount = 0;           ///< Количество команд в очереди
+    bool       asyncMode  = false;       ///< Не ждать отправки команд без ответа
+    uint32_t   txSentAt   = 0;           ///< Время отправки текущей команды, мкс
+    uint16_t   txTimeout  = MP3_TIMEOUT_FIRST_BYTE; ///< Сколько ждать начала ответа на неё, мс
+    uint8_t    txCommand  = 0;           ///< Байт текущей (последней отправленной) команды
+    bool       txLearn    = true;        ///< Учитывать задержку ответа на неё (не учитывается сразу за поиском пути)
+    uint32_t   txWireEndAt = 0;          ///< Когда последний отправленный байт уйдёт с линии, мкс
+    uint16_t   frameGap   = MP3_FRAME_GAP;            ///< Пауза между кадрами, мкс
+    uint16_t   byteTime   = 10000000UL / MP3_BAUD_RATE; ///< Время передачи одного байта, мкс
+    bool       batchHold  = false;       ///< Идёт набор пакета (beginBatch), команды без ответа не отправляются
+    uint32_t   rxLastByteAt = 0;         ///< Время приёма последнего байта, мкс
+    uint32_t   rxFrameAt    = 0;         ///< Время приёма первого байта (0xAA) текущего кадра, мкс
+    uint32_t   rxMaxGap     = 0;         ///< Самая длинная пауза между байтами текущего кадра, мкс
+    uint16_t   rxBacklog    = 0;         ///< Сколько байтов в буфере порта пришло после читаемого (см. receive())
+
+    AlashUartMP3Latency latencies[MP3_LATENCY_SLOTS] = {}; ///< См. latencyStats()
+    uint8_t    latencyNext  = 0;         ///< Какую запись занять под следующую новую команду
+    uint32_t   gapMean      = 0;         ///< Самая длинная пауза между байтами кадра, скользящее среднее, мкс
+    uint32_t   gapDeviation = 0;
+    bool       gapMeasured  = false;
+    uint16_t   firstByteMin = MP3_TIMEOUT_FIRST_BYTE_MIN;
+    uint16_t   firstByteMax = MP3_TIMEOUT_FIRST_BYTE;
+    uint16_t   interByteMin = MP3_TIMEOUT_INTERBYTE_MIN;
+    uint16_t   interByteMax = MP3_TIMEOUT_INTERBYTE;
+    uint16_t   interByteTimeoutMs = MP3_TIMEOUT_INTERBYTE;
+    uint8_t    lateCommand  = 0;         ///< Команда, ответ на которую не дождались (ещё может прийти)
+    uint32_t   lateSentAt   = 0;         ///< Когда она была отправлена, мкс
+
+    uint8_t        waitStrategy = MP3_WAIT_SPIN; ///< См. setWaitStrategy()
+    MP3WaitHandler waitHandler  = 0;             ///< См. setWaitHandler()
+    void          *waitContext  = 0;
+    bool           waitWakes    = false;         ///< waitHandler возвращается сам при приходе байтов
+
+    /** Запись задержки для команды (NULL - ещё не измерялась). */
+
+    AlashUartMP3Latency *findLatency(uint8_t command);
+
+    /** Учёт задержки начала ответа на команду. */
+
+    void learnLatency(uint8_t command, uint32_t micros);
+
+    /** Учёт самой длинной паузы между байтами принятого кадра. */
+
+    void learnGap(uint32_t micros);
+
+    /** Скользящее среднее и среднее отклонение (как SRTT и RTTVAR в TCP). */
+
+    static void smooth(uint32_t &mean, uint32_t &deviation, uint32_t sample, bool first);
+
+    /** Таймаут из средней задержки и отклонения в пределах, мс. */
+
+    static uint16_t deadline(uint32_t mean, uint32_t deviation, uint16_t minMs, uint16_t maxMs);
+
+    bool     positionSubscription = false; ///< Включена ли постоянная отчётность о позиции
+    uint16_t lastPosition   = 0;           ///< Последняя присланная позиция, секунды
+    uint32_t lastPositionAt = 0;           ///< Когда она пришла, мс
+
+    MP3PositionHandler positionHandler    = 0; ///< См. onPositionReport()
+    void              *positionContext    = 0;
+    MP3FrameHandler    unsolicitedHandler = 0; ///< См. onUnsolicitedFrame()
+    void              *unsolicitedContext = 0;
+
+#if MP3_METRICS
+    AlashUartMP3Metrics metrics = AlashUartMP3Metrics(); ///< См. getMetrics()
+#endif
 
 
     uint8_t currentVolume = 67; ///< Запись текущего уровня громкости (0-100, конвертируется в 0-30 для модуля)
     uint8_t currentEq     = 0;  ///< Запись текущего эквалайзера (JQ8400 не имеет способа запросить)
     uint8_t currentLoop   = 2;  ///< Запись текущего режима циклирования (JQ8400 не имеет способа запросить)
+    uint8_t currentSource = MP3_SRC_UNKNOWN; ///< Запись текущего источника (MP3_SRC_UNKNOWN - ещё не известен)
+
+    AlashUartMP3FolderIndex *folderIndex = 0; ///< См. setFolderIndex()
+    AlashUartMP3Request      folderBefore;   ///< Номер файла до запуска по пути, который сверяет папку
+    AlashUartMP3Request      folderAfter = AlashUartMP3Request(folderChecked, this); ///< И после него
+    uint8_t                  checkFolder = 0; ///< Сверяемая папка
+    uint16_t                 checkIndex  = 0; ///< Номер FAT запущенного в ней файла по каталогу
+    AlashUartMP3Group       *group       = 0; ///< См. setGroup()
+    AlashUartMP3Snapshot    *snapshotTarget = 0; ///< Снимок, который сейчас заполняется ответами (см. snapshot())
+    uint32_t                 snapshotLastAt = 0; ///< Когда пришёл последний ответ для снимка, мс
+
+    uint8_t  sentVolume    = MP3_STATE_UNKNOWN; ///< Громкость, отправленная модулю (0-30)
+    uint8_t  sentEq        = MP3_STATE_UNKNOWN; ///< Эквалайзер, отправленный модулю
+    uint8_t  sentLoop      = MP3_STATE_UNKNOWN; ///< Режим циклирования, отправленный модулю
+    bool     coalesce      = false;             ///< См. setCoalescing()
+    uint16_t coalesceDeadline = MP3_COALESCE_DEADLINE;
+    uint16_t volumeSteps   = 0;                 ///< Сколько volumeUp()/volumeDn() ждут отправки
+    uint8_t  volumeTarget  = 0;                 ///< Громкость модуля (0-30), к которой они приводят
+    uint32_t volumeStepAt  = 0;                 ///< Когда пришёл первый из них, мс
+    uint32_t framesSaved   = 0;                 ///< См. getFramesSaved()
+
+    uint8_t  statusChecks   = MP3_STATUS_CHECKS_IN_AGREEMENT; ///< См. setStatusChecks()
+    uint8_t  lastStatus     = MP3_STATE_UNKNOWN; ///< Последний принятый статус
+    uint8_t  expectedStatus = MP3_STATE_UNKNOWN; ///< Статус, который должна дать последняя отправленная команда
+    uint8_t  statusTrust    = 0;                 ///< См. statusConfidence()
+    uint32_t pausedTotal    = 0;                 ///< См. pausedMillis(), без текущей паузы
+    uint32_t pauseStartedAt = 0;                 ///< Когда отправлена pause(), мс (0 - не на паузе)
+
+    static const uint8_t MP3_STATE_UNKNOWN = 0xFF;
+
+    /** Запоминание статуса, который должна дать отправленная команда. */
+
+    void expectStatus(uint8_t command);
+
+    /** Постановка накопленной громкости в очередь одной командой.
+     *
+     * @param wait Ждать места в очереди, иначе при заполненной очереди отправка откладывается.
+     */
+
+    void flushVolume(bool wait);
+
+    /** Громкость модуля (0-30) с учётом ещё не отправленных шагов, MP3_STATE_UNKNOWN - неизвестна. */
+
+    uint8_t volumeOnModule();
+
+    /** Номер FAT файла в папке по каталогу, 0 - каталога нет или папки в нём нет (в том числе папки больше 255). */
+
+    uint16_t folderFileIndex(uint16_t folderNumber, uint16_t fileNumber);
+
+    /** Запуск файла в папке по пути с символами подстановки и, если папка есть в каталоге, её сверка с именем.
+     *
+     * @param fileIndex Номер FAT этого файла по каталогу, 0 - папки нет в каталоге.
+     */
+
+    void playFolderPath(uint8_t *path, uint8_t length, uint16_t folderNumber, uint16_t fileIndex);
+
+    /** Завершение запроса номера файла после запуска по пути (см. playFolderPath()): сверка папки в каталоге. */
+
+    static void folderChecked(AlashUartMP3Request &request);
+    uint8_t knownSources  = MP3_SRC_UNKNOWN; ///< Последняя полученная битовая маска доступных источников
+    bool    probing       = false;           ///< Идёт waitReady(), ответы на проверки считаются
+    uint8_t readyProbes   = 0;               ///< Сколько проверок отправил последний waitReady()
+    uint8_t readyAnswers  = 0;               ///< И сколько из них получили ответ
+
+    /** Установка громкости (0-100), эквалайзера и режима цикла: модулю уходят только те,
+     *  что отличаются от уже отправленных (sentVolume/sentEq/sentLoop).
+     */
+
+    void applySettings(uint8_t volume, uint8_t equalizer, uint8_t loopMode);
+
+    AlashUartMP3Store *store      = 0;     ///< См. setStore()
+    uint16_t storeDelay           = MP3_STORE_DELAY;
+    bool     storeLoaded          = false; ///< В storedState - прочитанная или записанная запись
+    bool     storeDirty           = false; ///< Настройки менялись после последней записи
+    uint32_t storeChangedAt       = 0;     ///< Когда они менялись последний раз, мс
+    uint8_t  storedState[4];               ///< Громкость, эквалайзер, режим цикла, источник - как в хранилище
+
+    /** Отметка изменения настроек для записи в хранилище. */
+
+    void stateChanged()
+    {
+      if(store)
+      {
+        storeDirty     = true;
+        storeChangedAt = millis();
+      }
+    }
+
+    /** Чтение настроек из хранилища в storedState.
+     *
+     * @return true, если там правильная запись
+     */
+
+    bool loadState();
+
+    /** Настройки для reset(): сохранённые, а если их нет - MP3_DEFAULT_... (громкость, эквалайзер, режим цикла). */
+
+    void startupSettings(uint8_t &volume, uint8_t &equalizer, uint8_t &loopMode);
+
+    /** Постановка в очередь выбора сохранённого источника, если он есть у модуля (по knownSources).
+     *
+     * @return true, если источник выбран
+     */
+
+    bool restoreSource();
+
+    static const uint8_t MP3_SRC_UNKNOWN = 0xFF;
+
+    /** Текущий источник: запомненный, а если он ещё не известен - запрошенный у модуля. */
+
+    uint8_t activeSource() { return currentSource == MP3_SRC_UNKNOWN ? getSource() : currentSource; }
 
     /** @name Определения байтов команд
      *
@@ -777,5 +1967,47 @@ class AlashUartMP3
     ///@}
 };
 
+/** AlashUartMP3 для порта известного класса.
+ *
+ *  Обычный AlashUartMP3 работает с любым `Stream`, поэтому каждый принятый байт - это виртуальные
+ *  вызовы `available()` и `read()`. Здесь в цикле приёма и при отправке кадра класс порта известен
+ *  при компиляции, и эти вызовы идут напрямую (`port->SerialType::read()`):
+ *
+ *      AlashUartMP3Serial<HardwareSerial> mp3(Serial2);
+ *      AlashUartMP3Serial<SoftwareSerial> mp3(mySerial);
+ *
+ *  Это не шаблон всей библиотеки: сами `receive()` и `send()` вызываются виртуально (раз за `poll()`
+ *  и раз за кадр), поэтому у AlashUartMP3 есть таблица виртуальных функций, а ожидание (`idleMicros()`)
+ *  проверяет порт через `Stream`. Выигрыш - только на вызовах внутри цикла приёма, и в примере Benchmark
+ *  на компьютере он в пределах погрешности; на платах он не измерялся.
+ *
+ *  SerialType должен быть именно классом объекта порта (а не его базовым классом), всё остальное -
+ *  как у AlashUartMP3.
+ */
+
+template<class SerialType> class AlashUartMP3Serial : public AlashUartMP3
+{
+  public:
+    AlashUartMP3Serial(SerialType &serial) : AlashUartMP3(serial) { port = &serial; }
+
+  protected:
+    SerialType *port;
+
+    virtual void receive()
+    {
+      int n;
+      while((n = port->SerialType::available()) > 0)
+      {
+        rxBacklog = n - 1;
+        this->handleRxByte(port->SerialType::read());
+      }
+    }
+
+    virtual void send(const uint8_t *buffer, uint8_t length)
+    {
+      port->SerialType::write(buffer, length);
+    }
+};
+
 #endif
 
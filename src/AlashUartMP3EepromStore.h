@@ -0,0 +1,71 @@
+/**
+ * Хранение настроек MP3-модуля JQ8400 в EEPROM.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3EepromStore_h
+#define AlashUartMP3EepromStore_h
+
+#include <EEPROM.h>
+#include "AlashUartMP3Store.h"
+
+/** Настройки в EEPROM, начиная с заданного адреса (занимают MP3_STORE_RECORD_SIZE байтов).
+ *
+ *  Перезаписываются только изменившиеся байты. На ESP8266/ESP32 EEPROM эмулируется во флеш-памяти:
+ *  вызовите `EEPROM.begin(размер)` до `mp3.reset()`, каждая запись заканчивается `EEPROM.commit()`.
+ *
+ *      AlashUartMP3EepromStore store(0);
+ *
+ *      void setup()
+ *      {
+ *        mp3.setStore(&store);
+ *        mp3.reset();              // настройки из EEPROM
+ *      }
+ */
+
+class AlashUartMP3EepromStore : public AlashUartMP3Store
+{
+  public:
+
+    AlashUartMP3EepromStore(int address = 0) : address(address) { }
+
+    virtual bool load(uint8_t *data, uint8_t length)
+    {
+      for(uint8_t x = 0; x < length; x++)
+      {
+        data[x] = EEPROM.read(address + x);
+      }
+      return true;
+    }
+
+    virtual bool save(const uint8_t *data, uint8_t length)
+    {
+      // Ресурс ячейки - около 100 000 записей, неизменившиеся байты не трогаем
+      for(uint8_t x = 0; x < length; x++)
+      {
+        if(EEPROM.read(address + x) != data[x])
+        {
+          EEPROM.write(address + x, data[x]);
+        }
+      }
+#if defined(ESP8266) || defined(ESP32)
+      return EEPROM.commit();
+#else
+      return true;
+#endif
+    }
+
+  protected:
+    int address;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * Хранение настроек MP3-модуля JQ8400 в файле.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3FileStore_h
+#define AlashUartMP3FileStore_h
+
+#include <stdio.h>
+#include "AlashUartMP3Store.h"
+
+/** Настройки в файле стандартной библиотеки C (fopen()) - для сборки на компьютере вместе с моделью
+ *  модуля AlashUartMP3Sim и для плат с файловой системой, поддерживающей stdio (ESP32 с SPIFFS/LittleFS по пути VFS).
+ *
+ *      AlashUartMP3FileStore store("/tmp/mp3.state");
+ */
+
+class AlashUartMP3FileStore : public AlashUartMP3Store
+{
+  public:
+
+    /** @param path Путь к файлу, строка должна существовать всё время работы. */
+
+    AlashUartMP3FileStore(const char *path) : path(path) { }
+
+    virtual bool load(uint8_t *data, uint8_t length)
+    {
+      FILE *f = fopen(path, "rb");
+      if(!f) return false;
+      bool ok = fread(data, 1, length, f) == length;
+      fclose(f);
+      return ok;
+    }
+
+    virtual bool save(const uint8_t *data, uint8_t length)
+    {
+      FILE *f = fopen(path, "wb");
+      if(!f) return false;
+      bool ok = fwrite(data, 1, length, f) == length;
+      ok = fclose(f) == 0 && ok;
+      return ok;
+    }
+
+  protected:
+    const char *path;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * Каталог папок носителя MP3-модуля JQ8400: номер FAT первого файла и количество файлов каждой папки.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3FolderIndex.h"
+
+AlashUartMP3FolderIndex::AlashUartMP3FolderIndex(AlashUartMP3 &mp3, AlashUartMP3Folder *folders, uint8_t capacity)
+{
+  this->mp3      = &mp3;
+  this->folders  = folders;
+  this->capacity = capacity;
+}
+
+uint8_t AlashUartMP3FolderIndex::scan(uint8_t firstFolderNumber)
+{
+  uint32_t start = millis();
+
+  firstFolder = firstFolderNumber;
+  count       = 0;
+
+  uint16_t current = mp3->currentFileIndexNumber();
+  uint16_t total   = mp3->countFiles();
+
+  // Папки идут в FAT подряд: следующая начинается сразу за последним файлом предыдущей
+  uint16_t fileIndex = 1;
+  while(fileIndex <= total && count < capacity)
+  {
+    mp3->seekFileByIndexNumber(fileIndex);
+
+    uint16_t first = mp3->currentFolderFirstIndex();
+    uint16_t files = mp3->currentFolderFileCount();
+
+    // Модуль не ответил или ответ не сходится с тем, куда мы перешли - дальше не доверяем
+    if(first != fileIndex || !files)
+    {
+      break;
+    }
+
+    // Имена должны идти подряд с 001: тогда первый файл - "001", а последний - по количеству файлов
+    uint8_t flags = 0;
+    if(this->currentNameIs(1))
+    {
+      mp3->seekFileByIndexNumber(first + files - 1);
+      if(this->currentNameIs(files)) flags = MP3_FOLDER_NAMED;
+    }
+
+    folders[count].first = first;
+    folders[count].count = files;
+    folders[count].flags = flags;
+    count++;
+
+    fileIndex = first + files;
+  }
+
+  if(current)
+  {
+    mp3->seekFileByIndexNumber(current);
+  }
+
+  scanTime = millis() - start;
+  return count;
+}
+
+bool AlashUartMP3FolderIndex::currentNameIs(uint16_t number)
+{
+  char name[12];
+  mp3->currentFileName(name, sizeof(name));
+  
+  if(number > 999 || isdigit(name[3])) return false;
+  for(int8_t x = 2; x >= 0; x--, number /= 10)
+  {
+    if(name[x] != '0' + number % 10) return false;
+  }
+  return true;
+}
+
+AlashUartMP3Folder *AlashUartMP3FolderIndex::folder(uint8_t folderNumber)
+{
+  if(folderNumber < firstFolder || folderNumber - firstFolder >= count) return NULL;
+  return &folders[folderNumber - firstFolder];
+}
+
+uint16_t AlashUartMP3FolderIndex::folderFileCount(uint8_t folderNumber)
+{
+  const AlashUartMP3Folder *f = this->folder(folderNumber);
+  return f ? f->count : 0;
+}
+
+uint16_t AlashUartMP3FolderIndex::folderFirstIndex(uint8_t folderNumber)
+{
+  const AlashUartMP3Folder *f = this->folder(folderNumber);
+  return f ? f->first : 0;
+}
+
+uint16_t AlashUartMP3FolderIndex::fileIndex(uint8_t folderNumber, uint16_t fileNumber)
+{
+  const AlashUartMP3Folder *f = this->folder(folderNumber);
+  if(!f || (f->flags & (MP3_FOLDER_NAMED | MP3_FOLDER_MISMATCH)) != MP3_FOLDER_NAMED || fileNumber < 1 || fileNumber > f->count) return 0;
+  return f->first + fileNumber - 1;
+}
+
+bool AlashUartMP3FolderIndex::confirmed(uint8_t folderNumber)
+{
+  const AlashUartMP3Folder *f = this->folder(folderNumber);
+  return f && (f->flags & MP3_FOLDER_CONFIRMED);
+}
+
+void AlashUartMP3FolderIndex::confirm(uint8_t folderNumber, bool matches)
+{
+  AlashUartMP3Folder *f = this->folder(folderNumber);
+  if(!f) return;
+  
+  f->flags |= matches ? MP3_FOLDER_CONFIRMED : MP3_FOLDER_MISMATCH;
+}
+
+bool AlashUartMP3FolderIndex::mismatched(uint8_t folderNumber)
+{
+  const AlashUartMP3Folder *f = this->folder(folderNumber);
+  return f && (f->flags & MP3_FOLDER_MISMATCH);
+}
@@ -0,0 +1,170 @@
+/**
+ * Каталог папок носителя MP3-модуля JQ8400: номер FAT первого файла и количество файлов каждой папки.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3FolderIndex_h
+#define AlashUartMP3FolderIndex_h
+
+#include "AlashUartMP3.h"
+
+// Флаги записи о папке
+#define MP3_FOLDER_NAMED     0x01 ///< Имена файлов идут подряд с "001" (проверены первый и последний при сканировании)
+#define MP3_FOLDER_CONFIRMED 0x02 ///< Модуль нашёл файл этой папки по пути там же, где каталог
+#define MP3_FOLDER_MISMATCH  0x04 ///< Модуль нашёл файл этой папки по пути в другом месте папки
+
+/** Запись каталога о папке. */
+
+struct AlashUartMP3Folder
+{
+  uint16_t first;  ///< Номер FAT первого файла папки
+  uint16_t count;  ///< Количество файлов в папке
+  uint8_t  flags;  ///< MP3_FOLDER_...
+};
+
+/** Каталог папок носителя.
+ *
+ *  `playFileNumberInFolderNumber()` отправляет модулю путь к файлу с символами подстановки, и модуль ищет его
+ *  перебором FAT - на большой карте это занимает заметное время. Каталог один раз узнаёт у модуля
+ *  первый файл и количество файлов каждой папки (MP3_CMD_FIRST_FILE_IN_FOLDER_IDX, MP3_CMD_COUNT_IN_FOLDER),
+ *  после чего файл в папке запускается сразу по номеру FAT:
+ *
+ *      AlashUartMP3 mp3(mySerial);
+ *      AlashUartMP3StaticFolderIndex<20> folders(mp3); // до 20 папок
+ *
+ *      void setup()
+ *      {
+ *        mp3.reset();
+ *        folders.scan();
+ *        mp3.setFolderIndex(&folders);
+ *        mp3.playFileNumberInFolderNumber(3, 6);     // /03/006.mp3 - уже без поиска пути
+ *      }
+ *
+ *  Сканирование проходит папки в порядке FAT: папка N - это N-я папка в FAT, файл M - M-й файл папки.
+ *  Это совпадает с именами ("01", "02"..., "001.mp3", "002.mp3"...), только если папки и файлы
+ *  скопированы по порядку имён (или FAT отсортирована, например, утилитой fatsort) и в именах нет пропусков,
+ *  поэтому каталог используется только там, где это проверено, а в остальных случаях файл запускается по пути, как без каталога:
+ *
+ *   * при сканировании у каждой папки читаются имена первого и последнего файла - они должны быть
+ *     "001" и номером, равным количеству файлов; папки с пропусками в именах (001, 002, 005)
+ *     и корень с файлами под другими именами в каталоге остаются, но по номеру FAT не запускаются;
+ *   * номер папки по позиции в FAT сверяется с именем при первом запуске из неё: этот запуск идёт по пути,
+ *     а модуль спрашивают, какой файл он нашёл (запросы в очереди, их ответы разбирает `poll()`, запуск не ждёт).
+ *     Совпал с каталогом - дальше папка запускается по номеру FAT; другой файл этой же папки - папка
+ *     до следующего сканирования запускается только по пути. Ответ вне папки (например, файлы лежат и в корне,
+ *     и все папки сдвинуты на одну) или прежний файл (модуль ещё ищет путь) ничего не решает: папка
+ *     сверяется снова при следующем запуске.
+ */
+
+class AlashUartMP3FolderIndex
+{
+  public:
+
+    /** Создание каталога.
+     *
+     * @param mp3      Модуль.
+     * @param folders  Массив записей о папках.
+     * @param capacity Размер массива.
+     */
+
+    AlashUartMP3FolderIndex(AlashUartMP3 &mp3, AlashUartMP3Folder *folders, uint8_t capacity);
+
+    /** Сканирование папок: шесть обменов с модулем на папку.
+     *
+     *  Останавливает воспроизведение, по окончании текущим снова становится файл, бывший текущим до сканирования.
+     *
+     * @param firstFolderNumber Номер первой папки (1, если папки называются "01", "02"..., 0 - если с "00").
+     * @return Количество папок в каталоге.
+     */
+
+    uint8_t  scan(uint8_t firstFolderNumber = 1);
+
+    /** Очистка каталога. */
+
+    void     clear() { count = 0; }
+
+    /** Количество папок в каталоге. */
+
+    uint8_t  folderCount() { return count; }
+
+    /** Количество файлов в папке, без обращения к модулю (0 - папки нет в каталоге). */
+
+    uint16_t folderFileCount(uint8_t folderNumber);
+
+    /** Номер FAT первого файла папки, без обращения к модулю (0 - папки нет в каталоге). */
+
+    uint16_t folderFirstIndex(uint8_t folderNumber);
+
+    /** Номер FAT файла в папке, без обращения к модулю.
+     *
+     * @param folderNumber Номер папки.
+     * @param fileNumber   Номер файла в папке, от 1.
+     * @return Номер FAT или 0, если такой папки или файла нет в каталоге.
+     */
+
+    uint16_t fileIndex(uint8_t folderNumber, uint16_t fileNumber);
+
+    /** Сверен ли номер папки с именем (см. confirm()). */
+
+    bool     confirmed(uint8_t folderNumber);
+
+    /** Результат сверки папки с именем: модуль запустил файл по пути, и его номер FAT совпал (или нет) с каталогом.
+     *
+     *  Несовпадение отключает эту папку до следующего сканирования.
+     *
+     * @param folderNumber Номер папки.
+     * @param matches      Совпал ли номер FAT найденного модулем файла с каталогом.
+     */
+
+    void     confirm(uint8_t folderNumber, bool matches);
+
+    /** Папка отключена: номер FAT найденного по пути файла не совпал с каталогом. */
+
+    bool     mismatched(uint8_t folderNumber);
+
+    /** Сколько длилось последнее сканирование, мс. */
+
+    uint32_t scanMillis() { return scanTime; }
+
+  protected:
+
+    AlashUartMP3       *mp3;
+    AlashUartMP3Folder *folders;
+    uint8_t             capacity;
+    uint8_t             count       = 0;
+    uint8_t             firstFolder = 1;
+    uint32_t            scanTime    = 0;
+
+    /** Запись о папке по номеру или NULL. */
+
+    AlashUartMP3Folder *folder(uint8_t folderNumber);
+
+    /** Начинается ли имя текущего файла с номера в три цифры (как "006     MP3"). */
+
+    bool     currentNameIs(uint16_t number);
+};
+
+/** Каталог папок со встроенной памятью на Capacity папок.
+ *
+ *      AlashUartMP3StaticFolderIndex<20> folders(mp3);
+ */
+
+template<uint8_t Capacity> class AlashUartMP3StaticFolderIndex : public AlashUartMP3FolderIndex
+{
+  public:
+    AlashUartMP3StaticFolderIndex(AlashUartMP3 &mp3) : AlashUartMP3FolderIndex(mp3, storage, Capacity) { }
+
+  protected:
+    AlashUartMP3Folder storage[Capacity];
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * Группа MP3-модулей JQ8400 на разных портах, обслуживаемых одновременно.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3Group.h"
+
+AlashUartMP3Group::AlashUartMP3Group(AlashUartMP3 **modules, uint8_t capacity)
+{
+  this->modules  = modules;
+  this->capacity = capacity;
+}
+
+bool AlashUartMP3Group::add(AlashUartMP3 &mp3)
+{
+  if(moduleCount >= capacity) return false;
+
+  modules[moduleCount++] = &mp3;
+  mp3.setGroup(this);
+  return true;
+}
+
+void AlashUartMP3Group::setAsync(bool async)
+{
+  for(uint8_t x = 0; x < moduleCount; x++)
+  {
+    modules[x]->setAsync(async);
+  }
+}
+
+void AlashUartMP3Group::update()
+{
+  this->pollExcept(NULL);
+}
+
+bool AlashUartMP3Group::idle()
+{
+  for(uint8_t x = 0; x < moduleCount; x++)
+  {
+    if(!modules[x]->idle()) return false;
+  }
+  return true;
+}
+
+void AlashUartMP3Group::flush()
+{
+  while(!this->idle())
+  {
+    // Ждёт первый занятый модуль, своим способом (setWaitStrategy(), setWaitHandler()), но не дольше
+    //  ближайшего срока всех занятых: приход байтов на чужой порт его ожидание не прерывает
+    AlashUartMP3 *waiting = NULL;
+    uint32_t      limit   = MP3_WAIT_MAX;
+    for(uint8_t x = 0; x < moduleCount; x++)
+    {
+      if(modules[x]->idle()) continue;
+      if(!waiting) waiting = modules[x];
+
+      uint32_t wait = modules[x]->idleMicros(false);
+      if(wait < limit) limit = wait;
+    }
+    waiting->waitIdle(limit);
+
+    this->update();
+  }
+}
+
+void AlashUartMP3Group::pollExcept(AlashUartMP3 *waiting)
+{
+  // Обработчик завершения запроса может сам вызвать блокирующую функцию другого модуля -
+  //  тогда проход уже идёт, и второй, вложенный, не нужен
+  if(servicing || !moduleCount) return;
+  servicing = true;
+
+  // Каждый проход начинается со следующего модуля: при медленной отправке (SoftwareSerial)
+  //  первый в проходе модуль иначе всегда получал бы линию раньше остальных
+  uint8_t n = nextFirst;
+  for(uint8_t x = 0; x < moduleCount; x++)
+  {
+    if(modules[n] != waiting)
+    {
+      modules[n]->poll();
+    }
+    if(++n >= moduleCount) n = 0;
+  }
+  if(++nextFirst >= moduleCount) nextFirst = 0;
+
+  servicing = false;
+}
@@ -0,0 +1,134 @@
+/**
+ * Группа MP3-модулей JQ8400 на разных портах, обслуживаемых одновременно.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Group_h
+#define AlashUartMP3Group_h
+
+#include "AlashUartMP3.h"
+
+/** Группа модулей.
+ *
+ *  Каждый модуль сидит на своём порту, и пока один из них передаёт кадр или готовит ответ,
+ *  остальные могут делать то же самое. Группа обслуживает все модули по очереди:
+ *
+ *   * `update()` - один проход по всем модулям (`poll()` каждого), начиная каждый раз со следующего модуля,
+ *     чтобы ни один модуль не получал обслуживание всегда первым;
+ *   * пока любой модуль группы ждёт в блокирующем вызове (getStatus(), flush(), заполненная очередь...),
+ *     он продолжает обслуживать остальные модули группы - их команды и ответы не стоят на месте.
+ *
+ *      AlashUartMP3 left(Serial1), right(Serial2), hall(mySoftwareSerial);
+ *      AlashUartMP3StaticGroup<3> speakers;
+ *
+ *      void setup()
+ *      {
+ *        speakers.add(left);
+ *        speakers.add(right);
+ *        speakers.add(hall);
+ *        speakers.setAsync(true);
+ *
+ *        left.playFileByIndexNumber(1);  // только ставится в очередь
+ *        right.playFileByIndexNumber(2);
+ *        hall.playFileByIndexNumber(3);
+ *        speakers.flush();               // три команды уходят одновременно
+ *      }
+ *
+ *      void loop()
+ *      {
+ *        speakers.update();              // вместо poll() каждого модуля
+ *      }
+ *
+ *  Запросы с ответом к нескольким модулям сразу - через request...() и `update()`, ответы ждутся параллельно.
+ *
+ *  SoftwareSerial принимает байты только на одном порту (см. `listen()`), поэтому модули, от которых
+ *  ждут ответов одновременно, должны быть на аппаратных портах.
+ */
+
+class AlashUartMP3Group
+{
+  public:
+
+    /** Создание группы.
+     *
+     * @param modules  Массив для указателей на модули.
+     * @param capacity Размер массива.
+     */
+
+    AlashUartMP3Group(AlashUartMP3 **modules, uint8_t capacity);
+
+    /** Добавление модуля в группу.
+     *
+     * @return false, если группа заполнена
+     */
+
+    bool          add(AlashUartMP3 &mp3);
+
+    /** Количество модулей в группе. */
+
+    uint8_t       count() { return moduleCount; }
+
+    /** Модуль группы по номеру, от 0 (NULL - нет такого). */
+
+    AlashUartMP3 *module(uint8_t number) { return number < moduleCount ? modules[number] : NULL; }
+
+    /** Асинхронный режим для всех модулей группы, см. `AlashUartMP3::setAsync()`. */
+
+    void          setAsync(bool async);
+
+    /** Один проход по всем модулям, без ожидания. Вызывайте в `loop()` как можно чаще. */
+
+    void          update();
+
+    /** Возвращает true, если очереди всех модулей пусты. */
+
+    bool          idle();
+
+    /** Блокирующее ожидание, пока очереди всех модулей не опустеют.
+     *
+     *  Ждёт способом ожидания первого занятого модуля (`AlashUartMP3::setWaitStrategy()`), не дольше
+     *  ближайшего срока обмена любого занятого модуля группы.
+     */
+
+    void          flush();
+
+    /** Обслуживание всех модулей, кроме одного (его блокирующего вызова, который ждёт своего ответа).
+     *
+     *  Вызывается самими модулями группы, вызывать из скетча не нужно.
+     */
+
+    void          pollExcept(AlashUartMP3 *waiting);
+
+  protected:
+
+    AlashUartMP3 **modules;
+    uint8_t        capacity;
+    uint8_t        moduleCount = 0;
+    uint8_t        nextFirst   = 0;     ///< С какого модуля начнётся следующий проход
+    bool           servicing   = false; ///< Проход уже идёт (из обработчика завершения внутри poll())
+};
+
+/** Группа со встроенной памятью на Capacity модулей.
+ *
+ *      AlashUartMP3StaticGroup<4> speakers;
+ */
+
+template<uint8_t Capacity> class AlashUartMP3StaticGroup : public AlashUartMP3Group
+{
+  public:
+    AlashUartMP3StaticGroup() : AlashUartMP3Group(storage, Capacity) { }
+
+  protected:
+    AlashUartMP3 *storage[Capacity];
+};
+
+#endif
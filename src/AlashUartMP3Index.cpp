@@ -0,0 +1,202 @@
+/**
+ * Каталог файлов носителя MP3-модуля JQ8400: поиск номера файла по имени и длины файла без обмена с модулем.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3Index.h"
+
+AlashUartMP3Index::AlashUartMP3Index(AlashUartMP3 &mp3, AlashUartMP3IndexEntry *entries, uint16_t *byName, uint16_t capacity)
+{
+  this->mp3      = &mp3;
+  this->entries  = entries;
+  this->byName   = byName;
+  this->capacity = capacity;
+}
+
+uint16_t AlashUartMP3Index::scan()
+{
+  uint32_t start = millis();
+
+  uint16_t current = mp3->currentFileIndexNumber();
+  fileCount  = mp3->countFiles();
+  entryCount = fileCount < capacity ? fileCount : capacity;
+
+  for(uint16_t x = 0; x < entryCount; x++)
+  {
+    // Модуль сообщает имя и длину только текущего файла
+    mp3->seekFileByIndexNumber(x + 1);
+
+    char name[MP3_INDEX_NAME_LENGTH + 1];
+    mp3->currentFileName(name, sizeof(name));
+    memcpy(entries[x].name, name, MP3_INDEX_NAME_LENGTH);
+    entries[x].seconds = mp3->currentFileLengthInSeconds();
+  }
+
+  if(current)
+  {
+    mp3->seekFileByIndexNumber(current);
+  }
+
+  this->sortByName();
+  scanTime = millis() - start;
+  return entryCount;
+}
+
+bool AlashUartMP3Index::refresh()
+{
+  if(entryCount && mp3->countFiles() == fileCount)
+  {
+    return false;
+  }
+
+  this->scan();
+  return true;
+}
+
+void AlashUartMP3Index::assign(uint16_t count)
+{
+  fileCount  = count;
+  entryCount = count < capacity ? count : capacity;
+  this->sortByName();
+}
+
+uint16_t AlashUartMP3Index::find(const char *name)
+{
+  // Приводим имя к виду ответа модуля: "ALARM.MP3" -> "ALARM   MP3"
+  char    key[MP3_INDEX_NAME_LENGTH];
+  uint8_t length = 0;
+  memset(key, ' ', sizeof(key));
+
+  const char *c = name;
+  for(uint8_t x = 0; x < 8 && *c && *c != '.'; x++)
+  {
+    key[x] = toupper(*c++);
+  }
+
+  if(*c == '.')
+  {
+    c++;
+    for(uint8_t x = 8; x < MP3_INDEX_NAME_LENGTH && *c; x++)
+    {
+      key[x] = toupper(*c++);
+    }
+    length = MP3_INDEX_NAME_LENGTH;
+  }
+  else if(strlen(name) == MP3_INDEX_NAME_LENGTH)
+  {
+    // Уже в виде ответа модуля
+    for(uint8_t x = 0; x < MP3_INDEX_NAME_LENGTH; x++)
+    {
+      key[x] = toupper(name[x]);
+    }
+    length = MP3_INDEX_NAME_LENGTH;
+  }
+  else
+  {
+    // Без расширения - сравниваем только имя
+    length = 8;
+  }
+
+  // Первая запись, имя которой не меньше искомого
+  uint16_t lo = 0;
+  uint16_t hi = entryCount;
+  while(lo < hi)
+  {
+    uint16_t mid = lo + (hi - lo) / 2;
+    if(this->compare(byName[mid], key, length) < 0)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  if(lo < entryCount && this->compare(byName[lo], key, length) == 0)
+  {
+    return byName[lo];
+  }
+  return 0;
+}
+
+const AlashUartMP3IndexEntry *AlashUartMP3Index::entry(uint16_t fileNumber)
+{
+  if(fileNumber < 1 || fileNumber > entryCount) return NULL;
+  return &entries[fileNumber - 1];
+}
+
+uint16_t AlashUartMP3Index::lengthInSeconds(uint16_t fileNumber)
+{
+  const AlashUartMP3IndexEntry *e = this->entry(fileNumber);
+  return e ? e->seconds : 0;
+}
+
+bool AlashUartMP3Index::fileName(uint16_t fileNumber, char *buffer, uint8_t bufferLength)
+{
+  const AlashUartMP3IndexEntry *e = this->entry(fileNumber);
+  if(!e || !bufferLength) return false;
+
+  // "ALARM   MP3" -> "ALARM.MP3"
+  uint8_t n = 0;
+  for(uint8_t x = 0; x < MP3_INDEX_NAME_LENGTH && n < bufferLength - 1; x++)
+  {
+    if(x == 8 && e->name[8] != ' ') buffer[n++] = '.';
+    if(e->name[x] != ' ' && n < bufferLength - 1) buffer[n++] = e->name[x];
+  }
+  buffer[n] = 0;
+  return true;
+}
+
+void AlashUartMP3Index::sortByName()
+{
+  for(uint16_t x = 0; x < entryCount; x++)
+  {
+    byName[x] = x + 1;
+  }
+
+  // Сортировка Шелла: без рекурсии и дополнительной памяти, для сотен файлов достаточно быстро
+  for(uint16_t gap = entryCount / 2; gap > 0; gap /= 2)
+  {
+    for(uint16_t x = gap; x < entryCount; x++)
+    {
+      uint16_t file = byName[x];
+      uint16_t y    = x;
+      while(y >= gap && this->compare(byName[y - gap], entries[file - 1].name, MP3_INDEX_NAME_LENGTH) > 0)
+      {
+        byName[y] = byName[y - gap];
+        y -= gap;
+      }
+      byName[y] = file;
+    }
+  }
+
+  // При равных именах раньше должен стоять меньший номер (сортировка Шелла неустойчива)
+  for(uint16_t x = 1; x < entryCount; x++)
+  {
+    uint16_t file = byName[x];
+    uint16_t y    = x;
+    while(y > 0 && byName[y - 1] > file && this->compare(byName[y - 1], entries[file - 1].name, MP3_INDEX_NAME_LENGTH) == 0)
+    {
+      byName[y] = byName[y - 1];
+      y--;
+    }
+    byName[y] = file;
+  }
+}
+
+int8_t AlashUartMP3Index::compare(uint16_t fileNumber, const char *name, uint8_t length)
+{
+  int c = memcmp(entries[fileNumber - 1].name, name, length);
+  return c < 0 ? -1 : (c > 0 ? 1 : 0);
+}
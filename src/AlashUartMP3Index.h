@@ -0,0 +1,174 @@
+/**
+ * Каталог файлов носителя MP3-модуля JQ8400: поиск номера файла по имени и длины файла без обмена с модулем.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Index_h
+#define AlashUartMP3Index_h
+
+#include "AlashUartMP3.h"
+
+// Длина имени файла в ответе модуля: 8.3 без точки, дополнено пробелами ("006     MP3")
+#define MP3_INDEX_NAME_LENGTH 11
+
+/** Запись каталога о файле с номером (index) на носителе. */
+
+struct AlashUartMP3IndexEntry
+{
+  char     name[MP3_INDEX_NAME_LENGTH]; ///< Имя как его присылает модуль, без завершающего нуля
+  uint16_t seconds;                     ///< Длина файла, секунды
+};
+
+/** Каталог файлов носителя.
+ *
+ *  Один раз (при запуске или после смены носителя) `scan()` проходит все файлы носителя
+ *  и запоминает имя и длину каждого, после чего номер файла по имени (двоичный поиск)
+ *  и сведения о файле по номеру выдаются без обращения к модулю:
+ *
+ *      AlashUartMP3 mp3(mySerial);
+ *      AlashUartMP3StaticIndex<100> files(mp3);   // до 100 файлов
+ *
+ *      void setup()
+ *      {
+ *        mp3.reset();
+ *        files.scan();
+ *        mp3.playFileByIndexNumber(files.find("ALARM.MP3"));
+ *      }
+ *
+ *  Память под каталог выделяет вызывающий код: массив записей и массив номеров, упорядоченных
+ *  по имени, по `capacity` элементов каждый (`bytesPerEntry()` байтов на файл). Заполненные записи
+ *  можно сохранить (например, в EEPROM) и при следующем запуске вернуть через `assign()`, не сканируя носитель.
+ *
+ *  Имена внутри разных папок могут совпадать, в этом случае `find()` возвращает меньший номер.
+ */
+
+class AlashUartMP3Index
+{
+  public:
+
+    /** Создание каталога.
+     *
+     * @param mp3      Модуль.
+     * @param entries  Массив записей, запись для файла с номером N - entries[N-1].
+     * @param byName   Массив для номеров файлов, упорядоченных по имени.
+     * @param capacity Размер обоих массивов.
+     */
+
+    AlashUartMP3Index(AlashUartMP3 &mp3, AlashUartMP3IndexEntry *entries, uint16_t *byName, uint16_t capacity);
+
+    /** Сканирование носителя: имя и длина каждого файла.
+     *
+     *  Останавливает воспроизведение, по окончании текущим снова становится файл, бывший текущим до сканирования.
+     *  Стоит три обмена с модулем на файл, время последнего сканирования - `scanMillis()`.
+     *
+     * @return Количество файлов в каталоге (не больше capacity).
+     */
+
+    uint16_t scan();
+
+    /** Повторное сканирование, если количество файлов на носителе изменилось (один запрос к модулю).
+     *
+     * @return true, если каталог был пересканирован
+     */
+
+    bool refresh();
+
+    /** Использование записей, уже находящихся в массиве entries (например, загруженных из EEPROM).
+     *
+     * @param count Количество записей.
+     */
+
+    void assign(uint16_t count);
+
+    /** Очистка каталога. */
+
+    void clear() { entryCount = 0; fileCount = 0; }
+
+    /** Количество файлов в каталоге. */
+
+    uint16_t count()     { return entryCount; }
+
+    /** Все ли файлы носителя поместились в каталог. */
+
+    bool     complete()  { return entryCount == fileCount; }
+
+    /** Номер файла по имени, без обращения к модулю.
+     *
+     * @param name Имя файла: "ALARM.MP3", "alarm.mp3", "ALARM" (любое расширение) или "ALARM   MP3" как в ответе модуля.
+     * @return Номер файла или 0, если такого файла нет.
+     */
+
+    uint16_t find(const char *name);
+
+    /** Запись о файле по номеру, без обращения к модулю.
+     *
+     * @return Запись или NULL, если файла с таким номером нет в каталоге.
+     */
+
+    const AlashUartMP3IndexEntry *entry(uint16_t fileNumber);
+
+    /** Длина файла по номеру, секунды (0 - нет в каталоге). */
+
+    uint16_t lengthInSeconds(uint16_t fileNumber);
+
+    /** Имя файла по номеру в виде "ALARM.MP3".
+     *
+     * @param buffer       Буфер, не меньше 13 байтов.
+     * @param bufferLength Размер буфера.
+     * @return false, если файла с таким номером нет в каталоге
+     */
+
+    bool     fileName(uint16_t fileNumber, char *buffer, uint8_t bufferLength);
+
+    /** Сколько длилось последнее сканирование, мс. */
+
+    uint32_t scanMillis() { return scanTime; }
+
+    /** Сколько байтов ОЗУ занимает каталог на каждый файл. */
+
+    static uint8_t bytesPerEntry() { return sizeof(AlashUartMP3IndexEntry) + sizeof(uint16_t); }
+
+  protected:
+
+    AlashUartMP3           *mp3;
+    AlashUartMP3IndexEntry *entries;
+    uint16_t               *byName;
+    uint16_t                capacity;
+    uint16_t                entryCount = 0;
+    uint16_t                fileCount  = 0;   ///< Файлов на носителе при последнем сканировании
+    uint32_t                scanTime   = 0;
+
+    /** Упорядочивание byName по имени (при равных именах - по номеру). */
+
+    void sortByName();
+
+    /** Сравнение имени записи с именем в формате ответа модуля, по первым length символам. */
+
+    int8_t compare(uint16_t fileNumber, const char *name, uint8_t length);
+};
+
+/** Каталог со встроенной памятью на Capacity файлов.
+ *
+ *      AlashUartMP3StaticIndex<200> files(mp3);
+ */
+
+template<uint16_t Capacity> class AlashUartMP3StaticIndex : public AlashUartMP3Index
+{
+  public:
+    AlashUartMP3StaticIndex(AlashUartMP3 &mp3) : AlashUartMP3Index(mp3, storage, order, Capacity) { }
+
+  protected:
+    AlashUartMP3IndexEntry storage[Capacity];
+    uint16_t               order[Capacity];
+};
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Ожидание MP3-модуля JQ8400 до уведомления о приходе байтов (ESP32, сборка на компьютере).
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Notifier_h
+#define AlashUartMP3Notifier_h
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "AlashUartMP3.h"
+
+/** Функция ожидания для `AlashUartMP3::setWaitHandler()`, которую будит событие приёма порта.
+ *
+ *  Блокирующий вызов библиотеки усыпляет свою задачу на std::condition_variable (на ESP32 - объекты FreeRTOS
+ *  через pthread, при сборке на компьютере - поток std::thread), ядро в это время свободно для других задач и WiFi.
+ *  Драйвер порта будит задачу, как только байты пришли, а если их нет - она просыпается сама к ближайшему сроку
+ *  обмена (таймауту ответа, паузе между кадрами).
+ *
+ *      AlashUartMP3Serial<HardwareSerial> mp3(Serial2);
+ *      AlashUartMP3Notifier               rxEvent;
+ *
+ *      void setup()
+ *      {
+ *        Serial2.begin(9600, SERIAL_8N1, 16, 17);
+ *        Serial2.onReceive([]() { rxEvent.notify(); }); // вызывается задачей событий UART
+ *        mp3.setWaitHandler(AlashUartMP3Notifier::wait, &rxEvent, true);
+ *        mp3.reset();
+ *      }
+ *
+ *  notify() можно вызывать из другой задачи или потока, но не из обработчика прерывания.
+ */
+
+class AlashUartMP3Notifier
+{
+  public:
+
+    /** Байты пришли: разбудить ожидание (уведомление до начала ожидания не теряется). */
+
+    void notify()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = true;
+      }
+      event.notify_one();
+    }
+
+    /** Ожидание уведомления, не дольше maxMicros. */
+
+    void waitFor(uint32_t maxMicros)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      event.wait_for(lock, std::chrono::microseconds(maxMicros), [this]() { return pending; });
+      pending = false;
+    }
+
+    /** Функция ожидания для setWaitHandler(), context - AlashUartMP3Notifier. */
+
+    static void wait(uint32_t maxMicros, void *context) { ((AlashUartMP3Notifier *)context)->waitFor(maxMicros); }
+
+  protected:
+    std::mutex              mutex;
+    std::condition_variable event;
+    bool                    pending = false;
+};
+
+#endif
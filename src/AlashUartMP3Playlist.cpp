@@ -0,0 +1,224 @@
+/**
+ * Список воспроизведения произвольной длины для MP3-модуля JQ8400.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3Playlist.h"
+
+AlashUartMP3Playlist::AlashUartMP3Playlist(AlashUartMP3 &mp3)
+{
+  this->mp3 = &mp3;
+}
+
+void AlashUartMP3Playlist::setTracks(const uint16_t *tracks, uint32_t count)
+{
+  this->tracks = tracks;
+  this->count  = count;
+  this->setSource(arraySource, this);
+}
+
+void AlashUartMP3Playlist::setTracks_P(const uint16_t *tracks, uint32_t count)
+{
+  this->tracks = tracks;
+  this->count  = count;
+  this->setSource(progmemSource, this);
+}
+
+void AlashUartMP3Playlist::setSource(MP3PlaylistSource source, void *context)
+{
+  this->source  = source;
+  this->context = context;
+}
+
+bool AlashUartMP3Playlist::start(uint32_t position)
+{
+  uint16_t fileNumber = source ? this->trackAt(position) : 0;
+  if(!fileNumber) return false;
+
+  if(state == MP3_PLAYLIST_IDLE)
+  {
+    savedLoop = mp3->getLoopMode();
+  }
+
+  // Модуль должен останавливаться после каждого трека - следующий выбирает список
+  mp3->setLoopMode(MP3_LOOP_NONE);
+  mp3->playFileByIndexNumber(fileNumber);
+
+  state  = MP3_PLAYLIST_PLAYING;
+  played = 0;
+  this->trackStarted(position, fileNumber);
+  return true;
+}
+
+void AlashUartMP3Playlist::stop()
+{
+  if(state == MP3_PLAYLIST_IDLE) return;
+
+  mp3->stop();
+  this->finish();
+}
+
+void AlashUartMP3Playlist::update()
+{
+  mp3->poll();
+  if(state == MP3_PLAYLIST_IDLE) return;
+
+  uint32_t now = millis();
+
+  // Длина текущего трека - от неё зависит, когда начинать следить за модулем
+  if(!lengthDone)
+  {
+    if(lengthIssued)
+    {
+      if(lengthRequest.pending()) return;
+      lengthIssued = false;
+      lengthDone   = true;
+      length       = lengthRequest.result == MP3_RESULT_OK ? lengthRequest.asSeconds() : 0;
+    }
+    else
+    {
+      if(!lengthRequest.pending()) lengthIssued = mp3->requestCurrentFileLengthInSeconds(lengthRequest);
+      return;
+    }
+  }
+
+  // До конца трека ещё далеко - модуль не трогаем; время на паузе трек не продвигает
+  uint32_t playedFor = now - startedAt - (mp3->pausedMillis() - pausedBefore);
+  if(length && (int32_t)(playedFor - (length * 1000UL - endWindow)) < 0)
+  {
+    return;
+  }
+
+  // Следующий трек идёт в FAT сразу за текущим - модуль перейдёт к нему сам, без паузы
+  if(!nextChecked)
+  {
+    nextChecked = true;
+
+    uint32_t position   = current + 1;
+    uint16_t fileNumber = this->trackAt(position);
+    if(fileNumber && fileNumber == track + 1)
+    {
+      nextTrack = fileNumber;
+      mp3->setLoopMode(MP3_LOOP_ALL);
+    }
+  }
+
+  if(watchRequest.pending()) return;
+
+  if(watchIssued)
+  {
+    watchIssued = false;
+
+    if(watchRequest.result == MP3_RESULT_OK)
+    {
+      if(watchIndex)
+      {
+        if(watchRequest.asUnsignedInt() == nextTrack)
+        {
+          // Модуль уже играет следующий трек, дальше он снова должен останавливаться
+          uint32_t position = current + 1;
+          this->trackAt(position);
+          mp3->setLoopMode(MP3_LOOP_NONE);
+          played++;
+          this->trackStarted(position, nextTrack);
+          return;
+        }
+      }
+      else if(watchRequest.asByte() == MP3_STATUS_STOPPED && now - startedAt >= MP3_PLAYLIST_SLOW_POLL)
+      {
+        played++;
+        this->playNext();
+        return;
+      }
+      else if(watchRequest.asByte() == MP3_STATUS_PAUSED)
+      {
+        // Паузу кнопкой на модуле библиотека не видит: до следующего вопроса считаем, что трек стоит
+        uint32_t paused = mp3->pausedMillis();
+        if(paused == pausedSeen) startedAt += MP3_PLAYLIST_SLOW_POLL;
+        pausedSeen  = paused;
+        nextWatchAt = now + MP3_PLAYLIST_SLOW_POLL;
+        return;
+      }
+    }
+  }
+
+  if((int32_t)(now - nextWatchAt) < 0) return;
+
+  // Около конца трека спрашиваем модуль раз в MP3_PLAYLIST_FAST_POLL, не чаще
+  watchIndex  = nextTrack != 0;
+  watchIssued = watchIndex ? mp3->requestCurrentFileIndexNumber(watchRequest) : mp3->requestStatus(watchRequest);
+  nextWatchAt = now + (length ? MP3_PLAYLIST_FAST_POLL : MP3_PLAYLIST_SLOW_POLL);
+}
+
+uint16_t AlashUartMP3Playlist::trackAt(uint32_t &position)
+{
+  uint16_t fileNumber = source(position, context);
+  if(!fileNumber && repeat && position)
+  {
+    position   = 0;
+    fileNumber = source(position, context);
+  }
+  return fileNumber;
+}
+
+void AlashUartMP3Playlist::trackStarted(uint32_t position, uint16_t fileNumber)
+{
+  current     = position;
+  track       = fileNumber;
+  startedAt   = millis();
+  pausedBefore = mp3->pausedMillis();
+  pausedSeen  = pausedBefore;
+  length      = 0;
+  lengthDone  = false;
+  nextTrack   = 0;
+  nextChecked = false;
+  nextWatchAt = startedAt;
+
+  // Ответы на запросы о прошлом треке, если они ещё в пути, уже не нужны
+  lengthIssued = !lengthRequest.pending() && mp3->requestCurrentFileLengthInSeconds(lengthRequest);
+  watchIssued  = false;
+}
+
+void AlashUartMP3Playlist::playNext()
+{
+  uint32_t position   = current + 1;
+  uint16_t fileNumber = this->trackAt(position);
+  if(!fileNumber)
+  {
+    this->finish();
+    return;
+  }
+
+  mp3->playFileByIndexNumber(fileNumber);
+  this->trackStarted(position, fileNumber);
+}
+
+void AlashUartMP3Playlist::finish()
+{
+  state = MP3_PLAYLIST_IDLE;
+  
+  // Неизвестный режим (warmStart() без хранилища) вернуть нельзя - модуль остаётся в MP3_LOOP_NONE
+  if(savedLoop != MP3_SETTING_UNKNOWN) mp3->setLoopMode(savedLoop);
+}
+
+uint16_t AlashUartMP3Playlist::arraySource(uint32_t position, void *context)
+{
+  AlashUartMP3Playlist *playlist = (AlashUartMP3Playlist *)context;
+  return position < playlist->count ? playlist->tracks[position] : 0;
+}
+
+uint16_t AlashUartMP3Playlist::progmemSource(uint32_t position, void *context)
+{
+  AlashUartMP3Playlist *playlist = (AlashUartMP3Playlist *)context;
+  return position < playlist->count ? pgm_read_word(&playlist->tracks[position]) : 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * Список воспроизведения произвольной длины для MP3-модуля JQ8400.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Playlist_h
+#define AlashUartMP3Playlist_h
+
+#include "AlashUartMP3.h"
+
+// За сколько миллисекунд до ожидаемого конца трека начинать следить за модулем
+#define MP3_PLAYLIST_END_WINDOW 1500
+
+// Как часто спрашивать модуль, пока трек на паузе или его длина неизвестна, мс
+#define MP3_PLAYLIST_SLOW_POLL 250
+
+// Как часто спрашивать модуль около конца трека, мс (запрос статуса на 9600 бод занимает линию около 11 мс)
+#define MP3_PLAYLIST_FAST_POLL 25
+
+/** Источник номеров файлов для списка воспроизведения.
+ *
+ * @param position Номер элемента списка, от 0.
+ * @param context  Указатель, переданный в setSource().
+ * @return Номер FAT файла или 0, если список закончился.
+ */
+
+typedef uint16_t (*MP3PlaylistSource)(uint32_t position, void *context);
+
+/** Список воспроизведения.
+ *
+ *  В отличие от `playSequenceByFileNumber()` (не больше MP3_SEQUENCE_MAX (127) файлов с именами из двух символов
+ *  в папке ZH, более длинный список не отправляется, а возвращает MP3_RESULT_TOO_LONG) список состоит из номеров FAT
+ *  любых файлов носителя и может быть любой длины: массив в ОЗУ, массив во флеш-памяти (PROGMEM) или функция,
+ *  выдающая номера по одному.
+ *
+ *      const uint16_t programme[] PROGMEM = { 12, 13, 14, 201, 7, 8 };
+ *
+ *      AlashUartMP3         mp3(mySerial);
+ *      AlashUartMP3Playlist playlist(mp3);
+ *
+ *      void setup()
+ *      {
+ *        mp3.reset();
+ *        playlist.setTracks_P(programme, sizeof(programme) / sizeof(programme[0]));
+ *        playlist.start();
+ *      }
+ *
+ *      void loop()
+ *      {
+ *        playlist.update(); // вместо mp3.poll()
+ *      }
+ *
+ *  Модуль не сообщает об окончании трека, поэтому список узнаёт длину каждого трека и за
+ *  MP3_PLAYLIST_END_WINDOW до ожидаемого конца начинает спрашивать модуль о состоянии (раз в MP3_PLAYLIST_FAST_POLL),
+ *  чтобы запустить следующий трек сразу, как только модуль остановится. Время на паузе в ожидаемый конец
+ *  не входит: паузы через `mp3.pause()` учитываются точно (`mp3.pausedMillis()`), а пауза кнопкой на модуле -
+ *  по ответам модуля около конца трека. Если следующий трек идёт
+ *  в FAT сразу за текущим, модулю заранее включается режим MP3_LOOP_ALL - он перейдёт к нему сам, без паузы.
+ *
+ *  На время работы списка режим цикла модуля меняется, после stop() или окончания списка восстанавливается.
+ */
+
+class AlashUartMP3Playlist
+{
+  public:
+
+    AlashUartMP3Playlist(AlashUartMP3 &mp3);
+
+    /** Список из массива номеров FAT в ОЗУ (массив должен существовать, пока играет список). */
+
+    void setTracks(const uint16_t *tracks, uint32_t count);
+
+    /** Список из массива номеров FAT во флеш-памяти (PROGMEM). */
+
+    void setTracks_P(const uint16_t *tracks, uint32_t count);
+
+    /** Список, номера которого выдаёт функция (генератор, чтение с SD-карты и т.п.). */
+
+    void setSource(MP3PlaylistSource source, void *context = 0);
+
+    /** Начинать ли список заново после последнего трека. */
+
+    void setRepeat(bool repeat) { this->repeat = repeat; }
+
+    /** За сколько миллисекунд до ожидаемого конца трека начинать следить за модулем. */
+
+    void setEndWindow(uint16_t ms) { endWindow = ms; }
+
+    /** Запуск списка.
+     *
+     * @param position С какого элемента начать, от 0.
+     * @return false, если в списке нет такого элемента
+     */
+
+    bool start(uint32_t position = 0);
+
+    /** Остановка воспроизведения и списка. */
+
+    void stop();
+
+    /** Продвижение списка, вызывайте из loop() как можно чаще (вызывает mp3.poll()). */
+
+    void update();
+
+    /** Играет ли список. */
+
+    bool     playing()      { return state != MP3_PLAYLIST_IDLE; }
+
+    /** Номер текущего элемента списка, от 0. */
+
+    uint32_t position()     { return current; }
+
+    /** Номер FAT текущего трека. */
+
+    uint16_t currentTrack() { return track; }
+
+    /** Сколько треков списка доиграно до конца. */
+
+    uint32_t tracksPlayed() { return played; }
+
+  protected:
+
+    static const uint8_t MP3_PLAYLIST_IDLE    = 0;
+    static const uint8_t MP3_PLAYLIST_PLAYING = 1;
+
+    AlashUartMP3     *mp3;
+
+    MP3PlaylistSource source  = 0;
+    void             *context = 0;
+    const uint16_t   *tracks  = 0;     ///< Массив номеров (setTracks()/setTracks_P())
+    uint32_t          count   = 0;
+    bool              repeat  = false;
+    uint16_t          endWindow = MP3_PLAYLIST_END_WINDOW;
+
+    uint8_t           state   = MP3_PLAYLIST_IDLE;
+    uint32_t          current = 0;     ///< Текущий элемент списка
+    uint16_t          track   = 0;     ///< Его номер FAT
+    uint16_t          nextTrack = 0;   ///< Номер FAT следующего трека, если модуль перейдёт к нему сам (MP3_LOOP_ALL)
+    uint32_t          played  = 0;
+    uint8_t           savedLoop = MP3_LOOP_NONE;
+
+    uint32_t          startedAt = 0;   ///< Когда запущен текущий трек, мс (сдвигается на время паузы кнопкой)
+    uint32_t          pausedBefore = 0; ///< mp3.pausedMillis() в момент запуска трека
+    uint32_t          pausedSeen   = 0; ///< mp3.pausedMillis() при прошлом ответе о паузе
+    uint16_t          length    = 0;   ///< Его длина, секунды (0 - ещё неизвестна)
+    uint32_t          nextWatchAt = 0; ///< Когда снова спросить модуль, мс
+
+    AlashUartMP3Request lengthRequest;
+    AlashUartMP3Request watchRequest;
+    bool              lengthIssued = false; ///< Запрос длины текущего трека в пути
+    bool              lengthDone   = false; ///< Длина текущего трека получена
+    bool              nextChecked  = false; ///< Проверено, можно ли перейти к следующему треку без паузы
+    bool              watchIssued  = false; ///< Запрос состояния в пути
+    bool              watchIndex   = false; ///< Это запрос номера файла (ждём перехода модуля к nextTrack)
+
+    /** Номер FAT элемента списка (0 - такого нет), с учётом повтора списка. */
+
+    uint16_t trackAt(uint32_t &position);
+
+    /** Трек начал играть: запоминаем время и запрашиваем его длину. */
+
+    void     trackStarted(uint32_t position, uint16_t fileNumber);
+
+    /** Запуск следующего элемента списка или завершение списка. */
+
+    void     playNext();
+
+    /** Завершение списка: режим цикла модуля возвращается к прежнему. */
+
+    void     finish();
+
+    static uint16_t arraySource(uint32_t position, void *context);
+    static uint16_t progmemSource(uint32_t position, void *context);
+};
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Хранение настроек MP3-модуля JQ8400 в NVS ESP32.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3PreferencesStore_h
+#define AlashUartMP3PreferencesStore_h
+
+#include <Preferences.h>
+#include "AlashUartMP3Store.h"
+
+/** Настройки в NVS ESP32 (библиотека Preferences), одним ключом в своём пространстве имён.
+ *
+ *  NVS сама распределяет записи по страницам флеш-памяти, так что отдельный износ ячейки не грозит.
+ *
+ *      AlashUartMP3PreferencesStore store("mp3");
+ *
+ *      void setup()
+ *      {
+ *        mp3.setStore(&store);
+ *        mp3.reset();
+ *      }
+ */
+
+class AlashUartMP3PreferencesStore : public AlashUartMP3Store
+{
+  public:
+
+    /** @param name Пространство имён NVS (до 15 символов), строка должна существовать всё время работы. */
+
+    AlashUartMP3PreferencesStore(const char *name = "mp3") : name(name) { }
+
+    virtual bool load(uint8_t *data, uint8_t length)
+    {
+      if(!prefs.begin(name, true)) return false;
+      bool ok = prefs.getBytes("state", data, length) == length;
+      prefs.end();
+      return ok;
+    }
+
+    virtual bool save(const uint8_t *data, uint8_t length)
+    {
+      if(!prefs.begin(name, false)) return false;
+      bool ok = prefs.putBytes("state", data, length) == length;
+      prefs.end();
+      return ok;
+    }
+
+  protected:
+    const char  *name;
+    Preferences  prefs;
+};
+
+#endif
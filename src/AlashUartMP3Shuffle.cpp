@@ -0,0 +1,141 @@
+/**
+ * Случайный порядок воспроизведения без повторов для MP3-модуля JQ8400.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#include <Arduino.h>
+#include "AlashUartMP3Shuffle.h"
+
+AlashUartMP3Shuffle::AlashUartMP3Shuffle(AlashUartMP3 &mp3)
+{
+  this->mp3 = &mp3;
+  memset(keys, 0, sizeof(keys));
+}
+
+uint16_t AlashUartMP3Shuffle::begin(uint32_t seed)
+{
+  this->setCount(mp3->countFiles(), seed);
+  return fileCount;
+}
+
+void AlashUartMP3Shuffle::setCount(uint16_t count, uint32_t seed)
+{
+  fileCount  = count;
+  last       = 0;
+  cycleCount = 0;
+
+  // Сеть Фейстеля перемешивает числа из чётного числа разрядов: берём наименьшее, вмещающее все номера
+  halfBits = 1;
+  while(halfBits < 8 && (1UL << (2 * halfBits)) < count)
+  {
+    halfBits++;
+  }
+
+  this->reshuffle(seed);
+}
+
+void AlashUartMP3Shuffle::reshuffle(uint32_t seed)
+{
+  if(!seed)
+  {
+    seed = ((uint32_t)random(0x7FFF) << 16) ^ (uint32_t)random(0x7FFFFFFF) ^ micros();
+    if(!seed) seed = 1;
+  }
+
+  // Ключи раундов из зерна (xorshift32)
+  for(uint8_t x = 0; x < MP3_SHUFFLE_ROUNDS; x++)
+  {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    keys[x] = (uint16_t)(seed ^ (seed >> 16));
+  }
+
+  index  = 0;
+  offset = 0;
+
+  // Новый круг не должен начаться с файла, которым закончился прошлый
+  if(fileCount > 1 && this->at(0) == last)
+  {
+    offset = 1;
+  }
+}
+
+uint16_t AlashUartMP3Shuffle::next()
+{
+  if(!fileCount) return 0;
+
+  if(index >= fileCount)
+  {
+    cycleCount++;
+    this->reshuffle();
+  }
+
+  last = this->at(index++);
+  return last;
+}
+
+uint16_t AlashUartMP3Shuffle::playNext()
+{
+  uint16_t fileNumber = this->next();
+  if(fileNumber)
+  {
+    mp3->playFileByIndexNumber(fileNumber);
+  }
+  return fileNumber;
+}
+
+uint16_t AlashUartMP3Shuffle::at(uint16_t position)
+{
+  if(position >= fileCount) return 0;
+
+  uint16_t value = position + offset;
+  if(value >= fileCount) value -= fileCount;
+
+  // Перестановка всех чисел из 2 * halfBits разрядов; пока результат вне диапазона - переставляем дальше.
+  // Так получается перестановка именно 0..fileCount-1. В среднем это 4^halfBits / fileCount шагов:
+  //  разрядов чётное число, поэтому диапазон больше fileCount до 4 раз, и шагов - до 4 (от 1 при fileCount = 4^halfBits)
+  do
+  {
+    value = this->permute(value);
+  } while(value >= fileCount);
+
+  return value + 1;
+}
+
+uint16_t AlashUartMP3Shuffle::permute(uint16_t value)
+{
+  uint8_t  mask  = (1U << halfBits) - 1;
+  uint8_t  left  = value >> halfBits;
+  uint8_t  right = value & mask;
+
+  for(uint8_t x = 0; x < MP3_SHUFFLE_ROUNDS; x++)
+  {
+    // Функция раунда не обязана быть обратимой - обратимость даёт сама сеть
+    uint16_t f = (right ^ keys[x]) * 0x9E37U;
+    f ^= f >> 8;
+    f *= 0x6B43U;
+
+    // Старшие разряды произведения зависят от всех разрядов аргумента
+    uint8_t  t = right;
+    right = (left ^ (f >> (16 - halfBits))) & mask;
+    left  = t;
+  }
+
+  return ((uint16_t)left << halfBits) | right;
+}
+
+uint16_t AlashUartMP3Shuffle::source(uint32_t position, void *context)
+{
+  AlashUartMP3Shuffle *shuffle = (AlashUartMP3Shuffle *)context;
+  return position < shuffle->fileCount ? shuffle->at(position) : 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * Случайный порядок воспроизведения без повторов для MP3-модуля JQ8400.
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Shuffle_h
+#define AlashUartMP3Shuffle_h
+
+#include "AlashUartMP3.h"
+
+// Количество раундов сети Фейстеля, которая перемешивает номера
+#define MP3_SHUFFLE_ROUNDS 6
+
+/** Случайный порядок воспроизведения.
+ *
+ *  Выдаёт номера FAT всех файлов носителя в случайном порядке, каждый ровно один раз за круг;
+ *  после последнего файла круга порядок перемешивается заново, и новый круг не начинается с файла,
+ *  которым закончился предыдущий.
+ *
+ *  Перестановка не хранится в памяти, а вычисляется: номер позиции в круге шифруется сетью
+ *  Фейстеля с ключом от зерна (обратимое преобразование, поэтому номера не повторяются),
+ *  вне диапазона файлов - шифруется ещё раз. Всё состояние - около тридцати байтов при любом числе
+ *  файлов, следующий номер вычисляется за несколько микросекунд без обмена с модулем.
+ *
+ *      AlashUartMP3        mp3(mySerial);
+ *      AlashUartMP3Shuffle shuffle(mp3);
+ *
+ *      void setup()
+ *      {
+ *        mp3.reset();
+ *        randomSeed(analogRead(A0));
+ *        shuffle.begin();              // один запрос countFiles()
+ *      }
+ *
+ *      void loop()
+ *      {
+ *        if(!mp3.busy()) shuffle.playNext();
+ *      }
+ *
+ *  Перемешанный круг можно отдать списку воспроизведения:
+ *
+ *      playlist.setSource(AlashUartMP3Shuffle::source, &shuffle);
+ */
+
+class AlashUartMP3Shuffle
+{
+  public:
+
+    AlashUartMP3Shuffle(AlashUartMP3 &mp3);
+
+    /** Узнаёт у модуля количество файлов и перемешивает их.
+     *
+     * @param seed Зерно перестановки, 0 - взять из random().
+     * @return Количество файлов.
+     */
+
+    uint16_t begin(uint32_t seed = 0);
+
+    /** Перемешивает count файлов (1..count) без обращения к модулю.
+     *
+     * @param count Количество файлов.
+     * @param seed  Зерно перестановки, 0 - взять из random().
+     */
+
+    void     setCount(uint16_t count, uint32_t seed = 0);
+
+    /** Перемешивает заново и начинает новый круг.
+     *
+     * @param seed Зерно перестановки, 0 - взять из random().
+     */
+
+    void     reshuffle(uint32_t seed = 0);
+
+    /** Номер FAT следующего файла (0 - файлов нет), без обращения к модулю. */
+
+    uint16_t next();
+
+    /** Запускает следующий файл.
+     *
+     * @return Его номер FAT (0 - файлов нет).
+     */
+
+    uint16_t playNext();
+
+    /** Номер FAT файла на позиции текущего круга.
+     *
+     * @param position Позиция, от 0.
+     * @return Номер FAT или 0, если позиция вне круга.
+     */
+
+    uint16_t at(uint16_t position);
+
+    /** Количество перемешиваемых файлов. */
+
+    uint16_t count()    { return fileCount; }
+
+    /** Сколько файлов текущего круга уже выдано. */
+
+    uint16_t position() { return index; }
+
+    /** Сколько кругов пройдено полностью. */
+
+    uint32_t cycles()   { return cycleCount; }
+
+    /** Источник для списка воспроизведения (AlashUartMP3Playlist::setSource()): текущий круг.
+     *
+     *  Список берёт номера по позиции и не меняет перестановку; при setRepeat(true) круг повторяется в том же порядке.
+     */
+
+    static uint16_t source(uint32_t position, void *context);
+
+  protected:
+
+    AlashUartMP3 *mp3;
+
+    uint16_t fileCount  = 0;
+    uint16_t index      = 0;  ///< Следующая позиция круга
+    uint16_t offset     = 0;  ///< Сдвиг начала круга (чтобы круг не начался с последнего файла прошлого)
+    uint16_t last       = 0;  ///< Последний выданный номер FAT
+    uint32_t cycleCount = 0;
+    uint8_t  halfBits   = 1;  ///< Разрядность половины номера в сети Фейстеля
+    uint16_t keys[MP3_SHUFFLE_ROUNDS];
+
+    /** Обратимое перемешивание числа из 2 * halfBits разрядов. */
+
+    uint16_t permute(uint16_t value);
+};
+
+#endif
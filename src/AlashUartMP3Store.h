@@ -0,0 +1,64 @@
+/**
+ * Постоянное хранилище настроек MP3-модуля JQ8400 (громкость, эквалайзер, режим цикла, источник).
+ *
+ * Copyright (C) 2020 Alash Engineer <alash.electronics@gmail.com>
+ *
+ * Данная библиотека предоставляется бесплатно для использования, копирования, модификации и распространения без ограничений.
+ *
+ * Библиотека предоставляется "КАК ЕСТЬ", без каких-либо гарантий.
+ *
+ * @author Alash Engineer, alash.electronics@gmail.com
+ * @license MIT License
+ * @file
+ */
+
+#ifndef AlashUartMP3Store_h
+#define AlashUartMP3Store_h
+
+#include "AlashUartMP3.h"
+
+// Размер записи настроек: признак и версия формата, громкость, эквалайзер, режим цикла, источник, контрольная сумма
+#define MP3_STORE_RECORD_SIZE 6
+
+/** Хранилище настроек, см. AlashUartMP3::setStore().
+ *
+ *  Библиотека сама собирает запись из MP3_STORE_RECORD_SIZE байтов, проверяет её при чтении
+ *  и записывает только изменившуюся запись, не чаще чем через MP3_STORE_DELAY после последнего изменения.
+ *  Хранилищу остаётся только прочитать и записать байты:
+ *
+ *   * `AlashUartMP3EepromStore`      - EEPROM (AVR, ESP8266/ESP32 с эмуляцией EEPROM);
+ *   * `AlashUartMP3PreferencesStore` - NVS ESP32 (библиотека Preferences);
+ *   * `AlashUartMP3FileStore`        - файл (компьютер, модель модуля AlashUartMP3Sim).
+ *
+ *  Своё хранилище (FRAM, SD-карта...) - наследник с двумя функциями:
+ *
+ *      class FramStore : public AlashUartMP3Store
+ *      {
+ *        public:
+ *          virtual bool load(uint8_t *data, uint8_t length)       { return fram.read(0, data, length); }
+ *          virtual bool save(const uint8_t *data, uint8_t length) { return fram.write(0, data, length); }
+ *      };
+ */
+
+class AlashUartMP3Store
+{
+  public:
+
+    virtual ~AlashUartMP3Store() {}
+
+    /** Чтение записи.
+     *
+     * @return false, если записи нет или прочитать её не удалось
+     */
+
+    virtual bool load(uint8_t *data, uint8_t length) = 0;
+
+    /** Запись (вызывается, только если запись изменилась).
+     *
+     * @return false, если записать не удалось
+     */
+
+    virtual bool save(const uint8_t *data, uint8_t length) = 0;
+};
+
+#endif